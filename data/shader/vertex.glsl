@@ -3,22 +3,46 @@ in vec3 a_vertexPosition;
 in vec3 a_vertexNormal;
 in vec4 a_vertexColor;
 
+// Packed voxel vertices: position in half voxel units, normal index and palette index.
+in uvec2 a_packedData;
+
 uniform mat4 u_projectionMatrix;
 uniform mat4 u_viewMatrix;
 uniform mat4 u_modelMatrix;
 uniform mat4 u_normalMatrix;
 
+uniform bool u_packedVertices;
+
+layout (std140, binding = 3) uniform PaletteBlock {
+    vec4 paletteColors[256];
+};
+
+const vec3 packedNormals[6] = vec3[6](
+    vec3( 1, 0, 0), vec3(-1, 0, 0),
+    vec3( 0, 1, 0), vec3( 0,-1, 0),
+    vec3( 0, 0, 1), vec3( 0, 0,-1)
+);
+
 out vec3 v_position;
 out vec3 v_normal;
 out vec4 v_color;
 
 
 void main(void) {
-    vec4 vertexWorldPosition = u_modelMatrix * vec4(a_vertexPosition, 1.0);
-    vec3 vertexWorldNormal = (u_normalMatrix * vec4(a_vertexNormal, 1.0)).xyz;
+    vec3 position = a_vertexPosition;
+    vec3 normal = a_vertexNormal;
+    vec4 color = a_vertexColor;
+    if (u_packedVertices) {
+        position = 0.5 * a_vertexPosition;
+        normal = packedNormals[a_packedData.x];
+        color = paletteColors[a_packedData.y];
+    }
+
+    vec4 vertexWorldPosition = u_modelMatrix * vec4(position, 1.0);
+    vec3 vertexWorldNormal = (u_normalMatrix * vec4(normal, 1.0)).xyz;
 
     gl_Position = u_projectionMatrix * u_viewMatrix * vertexWorldPosition;
     v_normal = vertexWorldNormal;
     v_position = vertexWorldPosition.xyz;
-    v_color = a_vertexColor;
+    v_color = color;
 }
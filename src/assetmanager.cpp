@@ -0,0 +1,82 @@
+#include "assetmanager.h"
+
+#include <chrono>
+#include <iostream>
+#include <utility>
+
+#include "importMagicaVoxel.h"
+#include "threadpool.h"
+
+
+bool VoxAsset::isReady() const {
+    return finished || future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+
+const std::vector<TileMap3d*>& VoxAsset::get() {
+    if (finished) {
+        return tileMaps;
+    }
+    finished = true;
+    try {
+        Contents contents = future.get();
+        tileMaps = std::move(contents.tileMaps);
+        instances = std::move(contents.instances);
+    } catch (const std::exception &e) {
+        error = std::current_exception();
+        std::cout << "[Error] AssetManager :: " << path << " :: " << e.what() << std::endl;
+        return tileMaps;
+    }
+    if (makeMeshes) {
+        for (TileMap3d* tileMap : tileMaps) {
+            tileMap->updateMesh();
+        }
+    }
+    if (onLoaded) {
+        onLoaded(tileMaps, instances);
+    }
+    return tileMaps;
+}
+
+
+std::shared_ptr<VoxAsset> AssetManager::loadVox(const std::string &path, bool makeMeshes, VoxAsset::Callback onLoaded) {
+    std::shared_ptr<VoxAsset> asset = std::make_shared<VoxAsset>();
+    asset->path = path;
+    asset->makeMeshes = makeMeshes;
+    asset->onLoaded = onLoaded;
+    MeshCache* cache = meshCache;
+    asset->future = ThreadPool::shared().submit([path, makeMeshes, cache]() {
+        bool success;
+        VoxAsset::Contents contents;
+        contents.tileMaps = MV::makeTileMapsFromFile(path.c_str(), false, success, &contents.instances);
+        // The models of a file are meshed one after another, each mesh uses the pool on its own.
+        // Instances share the mesh of their model.
+        if (makeMeshes) {
+            for (TileMap3d* tileMap : contents.tileMaps) {
+                tileMap->prepareMesh(cache);
+            }
+        }
+        return contents;
+    });
+    pending.push_back(asset);
+    return asset;
+}
+
+
+void AssetManager::update() {
+    if (pending.empty()) {
+        return;
+    }
+    for (size_t i = 0; i < pending.size();) {
+        if (pending[i]->isReady()) {
+            pending[i]->get();
+            pending[i] = pending.back();
+            pending.pop_back();
+        } else {
+            i++;
+        }
+    }
+    if (pending.empty() && meshCache != nullptr) {
+        std::cout << "Mesh cache: " << meshCache->getHits() << " hits, " << meshCache->getMisses() << " misses." << std::endl;
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef ASSETMANAGER_H
+#define ASSETMANAGER_H
+
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "importMagicaVoxel.h"
+#include "meshcache.h"
+#include "tilemap3d.h"
+
+
+// Models of a .vox file loaded by an AssetManager, with their placements in the scene graph of the
+// file. The tilemaps belong to the caller, as with MV::makeTileMapsFromFile.
+class VoxAsset {
+    public:
+        typedef std::function<void(const std::vector<TileMap3d*>&, const std::vector<MV::Instance>&)> Callback;
+
+        const std::string& getPath() const {return path;}
+        // Whether loading and meshing are finished, so get does not wait.
+        bool isReady() const;
+        // Waits for the models and passes their meshes to the Renderer, so only call it on the GL thread.
+        // Empty if the file could not be loaded.
+        const std::vector<TileMap3d*>& get();
+        // Model indices index the tilemaps of get. Empty before get.
+        const std::vector<MV::Instance>& getInstances() const {return instances;}
+        bool failed() const {return error != nullptr;}
+
+    private:
+        friend class AssetManager;
+
+        struct Contents {
+            std::vector<TileMap3d*> tileMaps;
+            std::vector<MV::Instance> instances;
+        };
+
+        std::string path;
+        bool makeMeshes;
+        Callback onLoaded;
+        std::future<Contents> future;
+        bool finished = false;
+        std::vector<TileMap3d*> tileMaps;
+        std::vector<MV::Instance> instances;
+        std::exception_ptr error;
+};
+
+
+// Loads .vox files and meshes their models on the shared thread pool, all requests at once. Only
+// handing the meshes to the Renderer, which is not thread safe, is left to the GL thread: in
+// VoxAsset::get for models needed right away, otherwise in update once they are ready.
+class AssetManager {
+    public:
+        // Meshes are looked up in and added to the cache, if there is one.
+        AssetManager(MeshCache* meshCache = nullptr) : meshCache(meshCache) {}
+
+        // Returns at once. onLoaded is called on the GL thread by get or update when the models are
+        // ready, with their meshes passed to the Renderer if makeMeshes is set.
+        std::shared_ptr<VoxAsset> loadVox(const std::string &path, bool makeMeshes, VoxAsset::Callback onLoaded = nullptr);
+
+        // Finishes the loads which are ready without waiting for the others, and reports the hits and
+        // misses of the mesh cache once all are finished. Call once per frame on the GL thread.
+        void update();
+        // Loads which are not finished yet.
+        int pendingCount() const {return pending.size();}
+
+    private:
+        MeshCache* meshCache;
+        std::vector<std::shared_ptr<VoxAsset>> pending;
+};
+
+
+#endif // ASSETMANAGER_H
@@ -0,0 +1,672 @@
+
+#include "benchmark.h"
+#include "chunkedtilemap3d.h"
+#include "distancefield.h"
+#include "importMagicaVoxel.h"
+#include "mesh.h"
+#include "voxelcomponents.h"
+#include "voxelmesher.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+
+
+namespace {
+const char* defaultFiles[] = {
+    "data/model/monu1.vox",
+    "data/model/mycastle.vox",
+    "data/model/castle.vox",
+    "data/model/menger.vox",
+    "data/model/teapot.vox",
+    "data/model/nature.vox",
+};
+
+const int REPETITIONS = 10;
+// Rays per raycast benchmark run.
+const int RAY_COUNT = 4096;
+
+// Results of measured code are written here, so the compiler cannot drop the computation.
+volatile int sink;
+
+struct BenchmarkSource {
+    TileMap3d* map;
+
+    glm::ivec3 size() const {
+        return glm::ivec3(map->getXSize(), map->getYSize(), map->getZSize());
+    }
+    unsigned int get(int x, int y, int z) const {
+        return map->getUnchecked(x, y, z);
+    }
+    bool isEmpty(int x, int y, int z) const {
+        if (x < 0 || y < 0 || z < 0 || x >= map->getXSize() || y >= map->getYSize() || z >= map->getZSize()) {
+            return true;
+        }
+        return map->getUnchecked(x, y, z) == 0;
+    }
+};
+
+// Number of solid voxels with an empty neighbour, through the wrapping accessor.
+int countSurfaceChecked(TileMap3d* map) {
+    int count = 0;
+    for (int x = 0; x < map->getXSize(); x++) {
+        for (int y = 0; y < map->getYSize(); y++) {
+            for (int z = 0; z < map->getZSize(); z++) {
+                if (map->get(x, y, z) == 0) continue;
+                if (map->get(x + 1, y, z) == 0 || map->get(x - 1, y, z) == 0 || map->get(x, y + 1, z) == 0 
+                    || map->get(x, y - 1, z) == 0 || map->get(x, y, z + 1) == 0 || map->get(x, y, z - 1) == 0) {
+                    count++;
+                }
+            }
+        }
+    }
+    return count;
+}
+
+// Same as countSurfaceChecked, with explicit bounds tests and the unchecked accessor.
+int countSurfaceUnchecked(TileMap3d* map) {
+    BenchmarkSource source{map};
+    int count = 0;
+    for (int x = 0; x < map->getXSize(); x++) {
+        for (int y = 0; y < map->getYSize(); y++) {
+            for (int z = 0; z < map->getZSize(); z++) {
+                if (map->getUnchecked(x, y, z) == 0) continue;
+                if (source.isEmpty(x + 1, y, z) || source.isEmpty(x - 1, y, z) || source.isEmpty(x, y + 1, z)
+                    || source.isEmpty(x, y - 1, z) || source.isEmpty(x, y, z + 1) || source.isEmpty(x, y, z - 1)) {
+                    count++;
+                }
+            }
+        }
+    }
+    return count;
+}
+
+
+// Rays from a sphere around the map towards random points inside it, so all of them cross the volume.
+std::vector<Ray> randomRays(TileMap3d* map, int count) {
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    const glm::vec3 size(map->getXSize(), map->getYSize(), map->getZSize());
+    const glm::vec3 center = size * 0.5f;
+    std::vector<Ray> rays(count);
+    for (Ray &ray : rays) {
+        glm::vec3 onSphere;
+        do {
+            onSphere = glm::vec3(unit(random), unit(random), unit(random)) * 2.0f - 1.0f;
+        } while (glm::length(onSphere) > 1.0f || glm::length(onSphere) < 0.01f);
+        ray.origin = center + glm::normalize(onSphere) * glm::length(size);
+        ray.direction = glm::vec3(unit(random), unit(random), unit(random)) * size - ray.origin;
+    }
+    return rays;
+}
+
+
+// Calls f(file, tileMaps) with the models of each file and deletes them afterwards. Files which do not
+// load are reported and skipped.
+template <class F>
+void forEachFile(const std::vector<std::string> &files, F f) {
+    for (const std::string &file : files) {
+        std::vector<TileMap3d*> tileMaps;
+        try {
+            bool success;
+            tileMaps = MV::makeTileMapsFromFile(file.c_str(), false, success);
+        } catch (const std::exception&) {
+            std::cout << "Could not load " << file << std::endl;
+            continue;
+        }
+        f(file, tileMaps);
+        for (TileMap3d* tileMap : tileMaps) {
+            delete tileMap;
+        }
+    }
+}
+
+// Octree with the same cells and palette as map.
+OctreeTileMap3d* makeOctree(const TileMap3d &map) {
+    OctreeTileMap3d* octree = new OctreeTileMap3d(map.getPalette(), map.getXSize(), map.getYSize(), map.getZSize());
+    for (int x = 0; x < map.getXSize(); x++) {
+        for (int y = 0; y < map.getYSize(); y++) {
+            for (int z = 0; z < map.getZSize(); z++) {
+                const unsigned int value = map.getUnchecked(x, y, z);
+                if (value != 0) {
+                    octree->set(x, y, z, value);
+                }
+            }
+        }
+    }
+    return octree;
+}
+
+// Raw bytes of the vertices of buffer, packed or not.
+std::string vertexBytes(const VoxelMesher::MeshBuffer &buffer) {
+    if (buffer.packed) {
+        return std::string((const char*)buffer.packedVertices.data(), buffer.packedVertices.size() * sizeof(Renderer::PackedVertex));
+    }
+    return std::string((const char*)buffer.vertices.data(), buffer.vertices.size() * sizeof(Renderer::Vertex));
+}
+
+// Whether both buffers hold the same bytes.
+bool identicalMeshes(const VoxelMesher::MeshBuffer &a, const VoxelMesher::MeshBuffer &b) {
+    return a.packed == b.packed && a.indices == b.indices && vertexBytes(a) == vertexBytes(b);
+}
+
+// Whether both buffers hold the same triangles, in any order.
+bool sameTriangles(const VoxelMesher::MeshBuffer &a, const VoxelMesher::MeshBuffer &b) {
+    auto triangles = [](const VoxelMesher::MeshBuffer &buffer) {
+        const std::string vertices = vertexBytes(buffer);
+        const size_t size = buffer.packed ? sizeof(Renderer::PackedVertex) : sizeof(Renderer::Vertex);
+        std::vector<std::string> result;
+        for (size_t i = 0; i + 2 < buffer.indices.size(); i += 3) {
+            std::string triangle;
+            for (size_t k = 0; k < 3; k++) {
+                triangle.append(vertices, buffer.indices[i + k] * size, size);
+            }
+            result.push_back(triangle);
+        }
+        std::sort(result.begin(), result.end());
+        return result;
+    };
+    return a.packed == b.packed && triangles(a) == triangles(b);
+}
+
+// Voxel count and bounds of each component, sorted, to compare labellings whose ids differ.
+std::vector<std::array<int, 7>> componentSummary(const VoxelComponents &components) {
+    std::vector<std::array<int, 7>> summary;
+    for (const VoxelComponents::Component &c : components.getComponents()) {
+        if (c.voxelCount > 0) {
+            summary.push_back({c.voxelCount, c.min.x, c.min.y, c.min.z, c.max.x, c.max.y, c.max.z});
+        }
+    }
+    std::sort(summary.begin(), summary.end());
+    return summary;
+}
+
+// Best time of REPETITIONS runs of f in milliseconds.
+template <class F>
+double bestTime(F f) {
+    double best = 0.0;
+    for (int i = 0; i < REPETITIONS; i++) {
+        auto start = std::chrono::high_resolution_clock::now();
+        f();
+        std::chrono::duration<double, std::milli> time = std::chrono::high_resolution_clock::now() - start;
+        if (i == 0 || time.count() < best) {
+            best = time.count();
+        }
+    }
+    return best;
+}
+}
+
+
+void Benchmark::run(std::vector<std::string> files) {
+    if (files.empty()) {
+        files.assign(std::begin(defaultFiles), std::end(defaultFiles));
+    }
+    meshing(files);
+    octree(files);
+    layout(files);
+    raycast(files);
+    editing();
+    components(files);
+    distanceField(files);
+    chunkCompression(files);
+    patching(files);
+    loading(files);
+}
+
+
+void Benchmark::meshing(const std::vector<std::string> &files) {
+    std::cout << "Meshing, best of " << REPETITIONS << " runs in ms" << std::endl;
+    std::cout << std::setw(28) << std::left << "model" << std::right << std::setw(8) << "mode"
+        << std::setw(10) << "scalar" << std::setw(10) << "bitmask" << std::setw(10) << "speedup" << std::setw(10) << "bricks" << std::endl;
+
+    forEachFile(files, [&](const std::string &file, const std::vector<TileMap3d*> &tileMaps) {
+        for (MeshingMode mode : {MeshingMode::NAIVE, MeshingMode::GREEDY}) {
+            double scalarTime = 0.0, bitmaskTime = 0.0, brickTime = 0.0;
+            int mismatches = 0;
+            for (TileMap3d* tileMap : tileMaps) {
+                BenchmarkSource source{tileMap};
+                const glm::vec3 offset = tileMap->center();
+
+                scalarTime += bestTime([&]() {
+                    VoxelMesher::MeshBuffer buffer;
+                    VoxelMesher::generate(source, mode, tileMap->getPalette(), offset, buffer);
+                });
+                // Building the occupancy is part of the measured time.
+                bitmaskTime += bestTime([&]() {
+                    VoxelMesher::MeshBuffer buffer;
+                    OccupancyMask occupancy;
+                    occupancy.build(source);
+                    VoxelMesher::generate(source, mode, tileMap->getPalette(), offset, buffer, &occupancy);
+                });
+                // Occupancy built only from the non-empty bricks.
+                brickTime += bestTime([&]() {
+                    VoxelMesher::MeshBuffer buffer;
+                    OccupancyMask occupancy;
+                    occupancy.build(source, &tileMap->getBrickMap());
+                    VoxelMesher::generate(source, mode, tileMap->getPalette(), offset, buffer, &occupancy);
+                });
+
+                // Segments meshed on the thread pool and stitched must match the serial mesh byte for byte.
+                VoxelMesher::MeshBuffer serial, stitched;
+                VoxelMesher::generate(source, mode, tileMap->getPalette(), offset, serial);
+                VoxelMesher::concatenate(VoxelMesher::generateSegmentsParallel(source, mode, 0,
+                    VoxelMesher::segmentCount(source.size(), mode), tileMap->getPalette(), offset, false), stitched);
+                if (!identicalMeshes(serial, stitched)) {
+                    mismatches++;
+                }
+            }
+
+            std::cout << std::setw(28) << std::left << file << std::right
+                << std::setw(8) << (mode == MeshingMode::GREEDY ? "greedy" : "naive")
+                << std::fixed << std::setprecision(2)
+                << std::setw(10) << scalarTime << std::setw(10) << bitmaskTime
+                << std::setw(9) << scalarTime / bitmaskTime << "x" << std::setw(10) << brickTime << std::endl;
+            if (mismatches > 0) {
+                std::cout << "Mismatch: " << mismatches << " of " << tileMaps.size()
+                    << " meshes stitched from parallel segments differ from the serial mesh" << std::endl;
+            }
+        }
+    });
+}
+
+
+void Benchmark::octree(const std::vector<std::string> &files) {
+    std::cout << "Dense vs. octree tilemaps, memory in KB, meshing best of " << REPETITIONS << " runs in ms" << std::endl;
+    std::cout << std::setw(28) << std::left << "model" << std::right << std::setw(8) << "mode"
+        << std::setw(10) << "dense" << std::setw(10) << "octree" << std::setw(10) << "dense" << std::setw(10) << "octree" << std::endl;
+
+    forEachFile(files, [&](const std::string &file, const std::vector<TileMap3d*> &tileMaps) {
+        std::vector<std::unique_ptr<OctreeTileMap3d>> octrees;
+        for (TileMap3d* tileMap : tileMaps) {
+            octrees.emplace_back(makeOctree(*tileMap));
+        }
+
+        size_t denseMemory = 0, octreeMemory = 0;
+        for (unsigned int i = 0; i < tileMaps.size(); i++) {
+            denseMemory += tileMaps[i]->memoryUsage();
+            octreeMemory += octrees[i]->memoryUsage();
+        }
+
+        for (MeshingMode mode : {MeshingMode::NAIVE, MeshingMode::GREEDY}) {
+            double denseTime = 0.0, octreeTime = 0.0;
+            int mismatches = 0;
+            for (unsigned int i = 0; i < tileMaps.size(); i++) {
+                BenchmarkSource source{tileMaps[i]};
+                const glm::vec3 offset = tileMaps[i]->center();
+                denseTime += bestTime([&]() {
+                    VoxelMesher::MeshBuffer buffer;
+                    OccupancyMask occupancy;
+                    occupancy.build(source);
+                    VoxelMesher::generate(source, mode, tileMaps[i]->getPalette(), offset, buffer, &occupancy);
+                });
+
+                octrees[i]->meshingMode = mode;
+                octreeTime += bestTime([&]() {
+                    VoxelMesher::MeshBuffer buffer;
+                    octrees[i]->generateMesh(buffer);
+                });
+
+                // Greedy meshes are built from the same slice masks, naive ones visit the faces in
+                // another order.
+                VoxelMesher::MeshBuffer dense, sparse;
+                VoxelMesher::generate(source, mode, tileMaps[i]->getPalette(), offset, dense);
+                octrees[i]->generateMesh(sparse);
+                if (mode == MeshingMode::GREEDY ? !identicalMeshes(dense, sparse) : !sameTriangles(dense, sparse)) {
+                    mismatches++;
+                }
+            }
+
+            std::cout << std::setw(28) << std::left << file << std::right
+                << std::setw(8) << (mode == MeshingMode::GREEDY ? "greedy" : "naive")
+                << std::setw(10) << denseMemory / 1024 << std::setw(10) << octreeMemory / 1024
+                << std::fixed << std::setprecision(2)
+                << std::setw(10) << denseTime << std::setw(10) << octreeTime << std::endl;
+            if (mismatches > 0) {
+                std::cout << "Mismatch: " << mismatches << " of " << tileMaps.size()
+                    << " octree meshes differ from the dense mesh" << std::endl;
+            }
+        }
+    });
+}
+
+
+void Benchmark::layout(const std::vector<std::string> &files) {
+    std::cout << "Cell layouts, neighbour scan and greedy meshing, best of " << REPETITIONS << " runs in ms" << std::endl;
+    std::cout << std::setw(28) << std::left << "model" << std::right << std::setw(8) << "layout"
+        << std::setw(10) << "checked" << std::setw(10) << "unchecked" << std::setw(10) << "meshing" << std::endl;
+
+    forEachFile(files, [&](const std::string &file, const std::vector<TileMap3d*> &tileMaps) {
+        for (CellLayout layout : {CellLayout::LINEAR, CellLayout::MORTON}) {
+            double checkedTime = 0.0, uncheckedTime = 0.0, meshingTime = 0.0;
+            for (TileMap3d* tileMap : tileMaps) {
+                tileMap->setLayout(layout);
+                checkedTime += bestTime([&]() { sink = countSurfaceChecked(tileMap); });
+                uncheckedTime += bestTime([&]() { sink = countSurfaceUnchecked(tileMap); });
+
+                BenchmarkSource source{tileMap};
+                meshingTime += bestTime([&]() {
+                    VoxelMesher::MeshBuffer buffer;
+                    OccupancyMask occupancy;
+                    occupancy.build(source);
+                    VoxelMesher::generate(source, MeshingMode::GREEDY, tileMap->getPalette(), tileMap->center(), buffer, &occupancy);
+                });
+            }
+
+            std::cout << std::setw(28) << std::left << file << std::right
+                << std::setw(8) << (layout == CellLayout::MORTON ? "morton" : "linear")
+                << std::fixed << std::setprecision(2)
+                << std::setw(10) << checkedTime << std::setw(10) << uncheckedTime << std::setw(10) << meshingTime << std::endl;
+        }
+    });
+}
+
+
+void Benchmark::raycast(const std::vector<std::string> &files) {
+    std::cout << "Raycasts of " << RAY_COUNT << " rays, best of " << REPETITIONS << " runs in ms" << std::endl;
+    std::cout << std::setw(28) << std::left << "model" << std::right << std::setw(10) << "voxels"
+        << std::setw(10) << "bricks" << std::setw(10) << "batched" << std::setw(10) << "hits" << std::endl;
+
+    forEachFile(files, [&](const std::string &file, const std::vector<TileMap3d*> &tileMaps) {
+        double voxelTime = 0.0, brickTime = 0.0, batchedTime = 0.0;
+        int hits = 0;
+        for (TileMap3d* tileMap : tileMaps) {
+            std::vector<Ray> rays = randomRays(tileMap, RAY_COUNT);
+            BenchmarkSource source{tileMap};
+
+            // Plain DDA for comparison, a brick map with no empty bricks never skips.
+            const glm::ivec3 size = source.size();
+            BrickMap full(size);
+            for (int x = 0; x < size.x; x++) {
+                for (int y = 0; y < size.y; y++) {
+                    for (int z = 0; z < size.z; z++) {
+                        full.setSolid(glm::ivec3(x, y, z), true);
+                    }
+                }
+            }
+            voxelTime += bestTime([&]() {
+                for (const Ray &ray : rays) {
+                    sink = VoxelRaycast::cast(source, full, ray).hit;
+                }
+            });
+            brickTime += bestTime([&]() {
+                for (const Ray &ray : rays) {
+                    sink = tileMap->raycast(ray).hit;
+                }
+            });
+            batchedTime += bestTime([&]() { sink = tileMap->raycastMany(rays).size(); });
+
+            for (const RayHit &hit : tileMap->raycastMany(rays)) {
+                hits += hit.hit;
+            }
+        }
+
+        std::cout << std::setw(28) << std::left << file << std::right << std::fixed << std::setprecision(2)
+            << std::setw(10) << voxelTime << std::setw(10) << brickTime << std::setw(10) << batchedTime
+            << std::setw(10) << hits << std::endl;
+    });
+}
+
+
+void Benchmark::editing() {
+    const int size = 256;
+    std::cout << "Filling a " << size << "^3 map, best of " << REPETITIONS << " runs in ms" << std::endl;
+    std::cout << std::setw(28) << std::left << "cell type" << std::right << std::setw(10) << "set"
+        << std::setw(10) << "setMany" << std::setw(10) << "fillBox" << std::setw(10) << "sphere" << std::endl;
+
+    const Palette palette(4);
+    std::vector<CellEdit> edits;
+    edits.reserve(size * size * size);
+    for (int x = 0; x < size; x++) {
+        for (int y = 0; y < size; y++) {
+            for (int z = 0; z < size; z++) {
+                edits.push_back({glm::ivec3(x, y, z), (unsigned int)(1 + (x + y + z) % 3)});
+            }
+        }
+    }
+
+    const std::pair<CellType, const char*> types[] = {
+        {CellType::UINT8, "uint8"}, {CellType::UINT32, "uint32"}, {CellType::PALETTE_PACKED, "palette packed"}
+    };
+    for (auto type : types) {
+        TileMap3d tileMap(palette, size, type.first);
+        double setTime = bestTime([&]() {
+            for (const CellEdit &edit : edits) {
+                tileMap.set(edit.position, edit.value);
+            }
+        });
+        double setManyTime = bestTime([&]() { tileMap.setMany(edits); });
+        // Alternate the value, so every run changes all cells.
+        unsigned int value = 1;
+        double fillTime = bestTime([&]() { tileMap.fillBox(glm::ivec3(0), glm::ivec3(size), value++ % 3 + 1); });
+        double sphereTime = bestTime([&]() { tileMap.fillSphere(glm::vec3(size * 0.5f), size * 0.5f, value++ % 3 + 1); });
+        sink = tileMap.getUnchecked(size / 2, size / 2, size / 2);
+
+        std::cout << std::setw(28) << std::left << type.second << std::right << std::fixed << std::setprecision(2)
+            << std::setw(10) << setTime << std::setw(10) << setManyTime << std::setw(10) << fillTime
+            << std::setw(10) << sphereTime << std::endl;
+    }
+}
+
+
+void Benchmark::components(const std::vector<std::string> &files) {
+    const int EDITS = 100;
+    std::cout << "Connected components, build best of " << REPETITIONS << " runs and mean update after removing a"
+        << " random 4^3 box in ms" << std::endl;
+    std::cout << std::setw(28) << std::left << "model" << std::right << std::setw(10) << "build"
+        << std::setw(10) << "update" << std::setw(10) << "islands" << std::endl;
+
+    forEachFile(files, [&](const std::string &file, const std::vector<TileMap3d*> &tileMaps) {
+        double buildTime = 0.0, updateTime = 0.0;
+        int islands = 0, mismatches = 0;
+        std::mt19937 random(1);
+        for (TileMap3d* tileMap : tileMaps) {
+            VoxelComponents components;
+            buildTime += bestTime([&]() { components.build(*tileMap); });
+
+            const glm::ivec3 size(tileMap->getXSize(), tileMap->getYSize(), tileMap->getZSize());
+            for (int i = 0; i < EDITS; i++) {
+                glm::ivec3 lo(random() % size.x, random() % size.y, random() % size.z);
+                tileMap->fillBox(lo, lo + 4, 0);
+                components.markChanged(lo, lo + 4);
+                auto start = std::chrono::high_resolution_clock::now();
+                islands += components.update(*tileMap).size();
+                std::chrono::duration<double, std::milli> time = std::chrono::high_resolution_clock::now() - start;
+                updateTime += time.count() / EDITS;
+            }
+
+            VoxelComponents fresh;
+            fresh.build(*tileMap);
+            if (components.componentCount() != fresh.componentCount()
+                || componentSummary(components) != componentSummary(fresh)) {
+                mismatches++;
+            }
+        }
+
+        std::cout << std::setw(28) << std::left << file << std::right << std::fixed << std::setprecision(3)
+            << std::setw(10) << buildTime << std::setw(10) << updateTime << std::setw(10) << islands << std::endl;
+        if (mismatches > 0) {
+            std::cout << "Mismatch: " << mismatches << " of " << tileMaps.size()
+                << " updated labellings differ from a fresh build" << std::endl;
+        }
+    });
+}
+
+
+void Benchmark::distanceField(const std::vector<std::string> &files) {
+    const int EDITS = 20;
+    std::cout << "Distance field, build best of " << REPETITIONS << " runs and mean update after removing a"
+        << " random 4^3 box in ms" << std::endl;
+    std::cout << std::setw(28) << std::left << "model" << std::right << std::setw(10) << "build"
+        << std::setw(10) << "update" << std::setw(10) << "KB" << std::endl;
+
+    forEachFile(files, [&](const std::string &file, const std::vector<TileMap3d*> &tileMaps) {
+        double buildTime = 0.0, updateTime = 0.0;
+        size_t memory = 0;
+        std::mt19937 random(1);
+        for (TileMap3d* tileMap : tileMaps) {
+            DistanceField field;
+            buildTime += bestTime([&]() { field.build(*tileMap); });
+            memory += field.memoryUsage();
+
+            const glm::ivec3 size(tileMap->getXSize(), tileMap->getYSize(), tileMap->getZSize());
+            for (int i = 0; i < EDITS; i++) {
+                glm::ivec3 lo(random() % size.x, random() % size.y, random() % size.z);
+                tileMap->fillBox(lo, lo + 4, 0);
+                auto start = std::chrono::high_resolution_clock::now();
+                field.update(*tileMap, lo, lo + 4);
+                std::chrono::duration<double, std::milli> time = std::chrono::high_resolution_clock::now() - start;
+                updateTime += time.count() / EDITS;
+            }
+        }
+
+        std::cout << std::setw(28) << std::left << file << std::right << std::fixed << std::setprecision(3)
+            << std::setw(10) << buildTime << std::setw(10) << updateTime << std::setw(10) << memory / 1024 << std::endl;
+    });
+}
+
+
+void Benchmark::chunkCompression(const std::vector<std::string> &files) {
+    std::cout << "Chunk compression, resident KB before and after compressing all chunks, time to compress"
+        << " them and to decode them again in ms" << std::endl;
+    std::cout << std::setw(28) << std::left << "model" << std::right << std::setw(10) << "chunks"
+        << std::setw(10) << "KB" << std::setw(10) << "KB comp" << std::setw(10) << "compress"
+        << std::setw(10) << "decode" << std::endl;
+
+    forEachFile(files, [&](const std::string &file, const std::vector<TileMap3d*> &tileMaps) {
+        ChunkedTileMap3d chunked(tileMaps[0]->getPalette());
+        for (TileMap3d* tileMap : tileMaps) {
+            for (int x = 0; x < tileMap->getXSize(); x++) {
+                for (int y = 0; y < tileMap->getYSize(); y++) {
+                    for (int z = 0; z < tileMap->getZSize(); z++) {
+                        chunked.set(x, y, z, tileMap->getUnchecked(x, y, z));
+                    }
+                }
+            }
+        }
+        const ChunkedTileMap3d::CompressionStats before = chunked.getCompressionStats();
+
+        chunked.coldFrames = 0;
+        double compressTime = 0.0, decodeTime = 0.0;
+        ChunkedTileMap3d::CompressionStats after;
+        for (int i = 0; i < REPETITIONS; i++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            chunked.compressColdChunks();
+            auto middle = std::chrono::high_resolution_clock::now();
+            after = chunked.getCompressionStats();
+            chunked.decompressAll();
+            auto end = std::chrono::high_resolution_clock::now();
+            compressTime += std::chrono::duration<double, std::milli>(middle - start).count() / REPETITIONS;
+            decodeTime += std::chrono::duration<double, std::milli>(end - middle).count() / REPETITIONS;
+        }
+
+        std::cout << std::setw(28) << std::left << file << std::right << std::fixed << std::setprecision(3)
+            << std::setw(10) << chunked.chunkCount() << std::setw(10) << before.residentBytes / 1024
+            << std::setw(10) << (after.residentBytes + after.compressedBytes) / 1024
+            << std::setw(10) << compressTime << std::setw(10) << decodeTime << std::endl;
+    });
+}
+
+
+void Benchmark::patching(const std::vector<std::string> &files) {
+    const int EDITS = 100;
+    std::cout << "Mesh patches, mean over " << EDITS << " removals of a random voxel of the largest model,"
+        << " update in ms and uploaded KB" << std::endl;
+    std::cout << std::setw(28) << std::left << "model" << std::right << std::setw(8) << "mode"
+        << std::setw(10) << "mesh KB" << std::setw(10) << "update" << std::setw(10) << "upload" << std::endl;
+
+    for (const std::string &file : files) {
+        MV::ModelLoader loader;
+        if (!loader.loadModel(file.c_str()) || loader.models.empty()) {
+            std::cout << "Could not load " << file << std::endl;
+            continue;
+        }
+        const MV::Model* model = &loader.models[0];
+        for (const MV::Model &m : loader.models) {
+            if (m.numVoxels > model->numVoxels) {
+                model = &m;
+            }
+        }
+        if (model->numVoxels == 0) {
+            continue;
+        }
+        SharedPalette palette(MV::makePalette(loader.isCustomPalette, loader.palette));
+
+        for (MeshingMode mode : {MeshingMode::NAIVE, MeshingMode::GREEDY}) {
+            TileMap3d* tileMap = MV::makeTileMapSingle(*model, palette, false);
+            tileMap->meshingMode = mode;
+            tileMap->updateMesh();
+            std::shared_ptr<Renderer::Mesh> mesh = Renderer::getMesh(tileMap->meshID);
+            const double meshSize = mesh->memoryUsage() / 1024.0;
+
+            double updateTime = 0.0, uploadSize = 0.0;
+            std::mt19937 random(1);
+            for (int i = 0; i < EDITS; i++) {
+                const MV::Voxel v = model->voxels[random() % model->numVoxels];
+                tileMap->set(v.x, v.y, v.z, 0);
+                auto start = std::chrono::high_resolution_clock::now();
+                tileMap->updateMesh();
+                std::chrono::duration<double, std::milli> time = std::chrono::high_resolution_clock::now() - start;
+                updateTime += time.count() / EDITS;
+                uploadSize += mesh->dirtyBytes() / 1024.0 / EDITS;
+                mesh->clearDirty();
+            }
+
+            std::cout << std::setw(28) << std::left << file << std::right << std::setw(8)
+                << (mode == MeshingMode::GREEDY ? "greedy" : "naive") << std::fixed << std::setprecision(1)
+                << std::setw(10) << meshSize << std::setprecision(3) << std::setw(10) << updateTime
+                << std::setprecision(1) << std::setw(10) << uploadSize << std::endl;
+
+            delete tileMap;
+        }
+    }
+}
+
+
+void Benchmark::loading(const std::vector<std::string> &files) {
+    std::cout << "Loading .vox files, best of " << REPETITIONS << " runs in ms" << std::endl;
+    std::cout << std::setw(28) << std::left << "model" << std::right << std::setw(10) << "parse"
+        << std::setw(10) << "setMany" << std::setw(10) << "import" << std::setw(10) << "speedup" << std::endl;
+
+    for (const std::string &file : files) {
+        MV::ModelLoader loader;
+        bool success = true;
+        double parseTime = bestTime([&]() { success &= loader.loadModel(file.c_str()); });
+        if (!success) {
+            std::cout << "Could not load " << file << std::endl;
+            continue;
+        }
+
+        SharedPalette palette(MV::makePalette(loader.isCustomPalette, loader.palette));
+        const CellType cellType = CellStorage::narrowestType(palette->size());
+        // The previous path: edits built from the records, then setMany.
+        double setManyTime = bestTime([&]() {
+            for (const MV::Model &model : loader.models) {
+                TileMap3d tileMap(palette, model.sizex, model.sizey, model.sizez, cellType);
+                std::vector<CellEdit> edits(model.numVoxels);
+                for (int i = 0; i < model.numVoxels; i++) {
+                    const MV::Voxel v = model.voxels[i];
+                    edits[i] = {glm::ivec3(v.x, v.y, v.z), v.colorIndex};
+                }
+                tileMap.setMany(edits);
+                sink = tileMap.surfaceHeight(0, 0);
+            }
+        });
+        double importTime = bestTime([&]() {
+            for (const MV::Model &model : loader.models) {
+                TileMap3d tileMap(palette, model.sizex, model.sizey, model.sizez, cellType);
+                tileMap.importVoxels(model.voxels, model.numVoxels);
+                sink = tileMap.surfaceHeight(0, 0);
+            }
+        });
+
+        std::cout << std::setw(28) << std::left << file << std::right << std::fixed << std::setprecision(3)
+            << std::setw(10) << parseTime << std::setw(10) << setManyTime << std::setw(10) << importTime
+            << std::setprecision(2) << std::setw(10) << setManyTime / importTime << std::endl;
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <string>
+#include <vector>
+
+
+// Micro-benchmarks which run without a window or GL context. Started with
+//     xyz --benchmark [file.vox ...]
+namespace Benchmark {
+
+// Runs all benchmarks on the given models, or on a default set from data/model if files is empty.
+void run(std::vector<std::string> files);
+
+// Compares the scalar face visibility test of the mesher with the occupancy bitmask kernel.
+void meshing(const std::vector<std::string> &files);
+
+// Compares memory and meshing time of dense tilemaps and OctreeTileMap3d.
+void octree(const std::vector<std::string> &files);
+
+// Neighbour scans through the checked and the unchecked TileMap3d accessors and meshing time, for
+// the linear and the Morton layout.
+void layout(const std::vector<std::string> &files);
+
+// Single ray casts with and without skipping empty bricks and batched casts on the thread pool.
+void raycast(const std::vector<std::string> &files);
+
+// Per-cell set compared with the bulk edits of TileMap3d.
+void editing();
+
+// Full connected component labelling compared with incremental updates after small removals.
+void components(const std::vector<std::string> &files);
+
+// Full signed distance field computation compared with local updates after small removals.
+void distanceField(const std::vector<std::string> &files);
+
+// Memory of a ChunkedTileMap3d before and after compressing all chunks, and the time to compress and
+// decode them.
+void chunkCompression(const std::vector<std::string> &files);
+
+// Time of TileMap3d::updateMesh after removing a single voxel and the bytes of the mesh it patches,
+// i.e. what the next draw uploads, for the largest model of each file.
+void patching(const std::vector<std::string> &files);
+
+// Time to parse .vox files and to fill their tilemaps through setMany and through the fused import of
+// the voxel records.
+void loading(const std::vector<std::string> &files);
+
+}
+
+
+#endif // BENCHMARK_H
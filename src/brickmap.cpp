@@ -0,0 +1,42 @@
+
+#include "brickmap.h"
+
+
+BrickMap::BrickMap(glm::ivec3 size) : size(size) {
+    if (glm::any(glm::lessThanEqual(size, glm::ivec3(0)))) {
+        return;
+    }
+    glm::ivec3 levelSize = size;
+    do {
+        levelSize = (levelSize + BRICK_SIZE - 1) >> BRICK_BITS;
+        sizes.push_back(levelSize);
+        counts.emplace_back(levelSize.x * levelSize.y * levelSize.z, 0);
+    } while (levelSize != glm::ivec3(1));
+}
+
+
+void BrickMap::setSolid(glm::ivec3 p, bool solid) {
+    // Go up while a brick changes between empty and non-empty.
+    for (int level = 0; level < levelCount(); level++) {
+        p >>= BRICK_BITS;
+        uint8_t &count = counts[level][brickIndex(level, p)];
+        if (solid) {
+            if (count++ != 0) break;
+        } else {
+            if (--count != 0) break;
+        }
+    }
+}
+
+
+void BrickMap::setBrickSolid(glm::ivec3 brick, bool solid) {
+    for (int level = 1; level < levelCount(); level++) {
+        brick >>= BRICK_BITS;
+        uint8_t &count = counts[level][brickIndex(level, brick)];
+        if (solid) {
+            if (count++ != 0) break;
+        } else {
+            if (--count != 0) break;
+        }
+    }
+}
@@ -0,0 +1,176 @@
+#ifndef BRICKMAP_H
+#define BRICKMAP_H
+
+#include <glm/vec3.hpp> // glm::ivec3
+#include <glm/common.hpp> // glm::min, glm::max
+#include <glm/vector_relational.hpp> // glm::any, glm::lessThanEqual
+
+#include <stdint.h>
+#include <vector>
+
+
+// Occupancy hierarchy over a voxel volume for skipping empty space. Level 0 counts the non-empty
+// cells of every brick of 4^3 cells, every higher level counts the non-empty bricks of the level
+// below in groups of 4^3, up to a level with a single brick. A region whose brick has count 0 on
+// any level is empty. Counts are updated incrementally, a change touches at most one brick per level.
+class BrickMap {
+    public:
+        static const int BRICK_BITS = 2;
+        static const int BRICK_SIZE = 1 << BRICK_BITS;
+
+        // All cells are empty.
+        BrickMap(glm::ivec3 size = glm::ivec3(0));
+
+        // Must be called whenever a cell changes between empty and non-empty.
+        void setSolid(glm::ivec3 p, bool solid);
+
+        // Recounts the level 0 bricks overlapping [lo, hi) with bool isSolid(glm::ivec3) after the cells
+        // were changed without setSolid. Reads every cell of these bricks.
+        template <class F>
+        void recount(glm::ivec3 lo, glm::ivec3 hi, F isSolid);
+        // Same after all cells in [lo, hi) were set to solid or empty. Only bricks partially covered by the
+        // box are read.
+        template <class F>
+        void fill(glm::ivec3 lo, glm::ivec3 hi, bool solid, F isSolid);
+
+        int levelCount() const {return counts.size();}
+        // Number of bricks per axis on a level.
+        glm::ivec3 levelSize(int level) const {return sizes[level];}
+        bool isBrickEmpty(int level, glm::ivec3 brick) const {
+            return counts[level][brickIndex(level, brick)] == 0;
+        }
+        // Highest level whose brick containing cell p is empty, -1 if the level 0 brick is not empty.
+        int emptyLevel(glm::ivec3 p) const {
+            int level = -1;
+            while (level + 1 < levelCount() && isBrickEmpty(level + 1, p >> (BRICK_BITS * (level + 2)))) {
+                level++;
+            }
+            return level;
+        }
+
+        // Calls f(glm::ivec3 lo, glm::ivec3 hi) with the part inside [lo, hi) of every non-empty level 0
+        // brick which overlaps the box. Empty bricks of all levels are skipped.
+        template <class F>
+        void forEachBrick(glm::ivec3 lo, glm::ivec3 hi, F f) const;
+
+    private:
+        glm::ivec3 size;
+        std::vector<glm::ivec3> sizes;
+        std::vector<std::vector<uint8_t>> counts;
+
+        int brickIndex(int level, glm::ivec3 brick) const {
+            return (brick.x * sizes[level].y + brick.y) * sizes[level].z + brick.z;
+        }
+
+        template <class F>
+        void forEachBrick(int level, glm::ivec3 brick, glm::ivec3 lo, glm::ivec3 hi, F &f) const;
+        // Sets the count of every level 0 brick overlapping [lo, hi) to brickCount(cellLo, cellHi).
+        template <class F>
+        void recountBricks(glm::ivec3 lo, glm::ivec3 hi, F brickCount);
+        // Updates the levels above 0 after a level 0 brick changed between empty and non-empty.
+        void setBrickSolid(glm::ivec3 brick, bool solid);
+};
+
+
+template <class F>
+void BrickMap::forEachBrick(glm::ivec3 lo, glm::ivec3 hi, F f) const {
+    lo = glm::max(lo, glm::ivec3(0));
+    hi = glm::min(hi, size);
+    if (counts.empty() || glm::any(glm::greaterThanEqual(lo, hi))) {
+        return;
+    }
+    forEachBrick(levelCount() - 1, glm::ivec3(0), lo, hi, f);
+}
+
+
+template <class F>
+void BrickMap::recount(glm::ivec3 lo, glm::ivec3 hi, F isSolid) {
+    recountBricks(lo, hi, [&](glm::ivec3 cellLo, glm::ivec3 cellHi) {
+        int count = 0;
+        for (int x = cellLo.x; x < cellHi.x; x++) {
+            for (int y = cellLo.y; y < cellHi.y; y++) {
+                for (int z = cellLo.z; z < cellHi.z; z++) {
+                    count += isSolid(glm::ivec3(x, y, z)) ? 1 : 0;
+                }
+            }
+        }
+        return count;
+    });
+}
+
+
+template <class F>
+void BrickMap::fill(glm::ivec3 lo, glm::ivec3 hi, bool solid, F isSolid) {
+    recountBricks(lo, hi, [&](glm::ivec3 cellLo, glm::ivec3 cellHi) {
+        if (glm::all(glm::greaterThanEqual(cellLo, lo)) && glm::all(glm::lessThanEqual(cellHi, hi))) {
+            const glm::ivec3 extent = cellHi - cellLo;
+            return solid ? extent.x * extent.y * extent.z : 0;
+        }
+        int count = 0;
+        for (int x = cellLo.x; x < cellHi.x; x++) {
+            for (int y = cellLo.y; y < cellHi.y; y++) {
+                for (int z = cellLo.z; z < cellHi.z; z++) {
+                    count += isSolid(glm::ivec3(x, y, z)) ? 1 : 0;
+                }
+            }
+        }
+        return count;
+    });
+}
+
+
+template <class F>
+void BrickMap::recountBricks(glm::ivec3 lo, glm::ivec3 hi, F brickCount) {
+    lo = glm::max(lo, glm::ivec3(0));
+    hi = glm::min(hi, size);
+    if (counts.empty() || glm::any(glm::greaterThanEqual(lo, hi))) {
+        return;
+    }
+    const glm::ivec3 first = lo >> BRICK_BITS;
+    const glm::ivec3 last = (hi - 1) >> BRICK_BITS;
+    for (int bx = first.x; bx <= last.x; bx++) {
+        for (int by = first.y; by <= last.y; by++) {
+            for (int bz = first.z; bz <= last.z; bz++) {
+                const glm::ivec3 brick(bx, by, bz);
+                const glm::ivec3 cellLo = brick << BRICK_BITS;
+                const int count = brickCount(cellLo, glm::min(cellLo + BRICK_SIZE, size));
+                uint8_t &old = counts[0][brickIndex(0, brick)];
+                if ((old == 0) != (count == 0)) {
+                    setBrickSolid(brick, count != 0);
+                }
+                old = count;
+            }
+        }
+    }
+}
+
+
+template <class F>
+void BrickMap::forEachBrick(int level, glm::ivec3 brick, glm::ivec3 lo, glm::ivec3 hi, F &f) const {
+    const int shift = BRICK_BITS * (level + 1);
+    const glm::ivec3 brickLo = brick << shift;
+    const glm::ivec3 brickHi = (brick + 1) << shift;
+    if (glm::any(glm::greaterThanEqual(brickLo, hi)) || glm::any(glm::lessThanEqual(brickHi, lo))) {
+        return;
+    }
+    if (counts[level][brickIndex(level, brick)] == 0) {
+        return;
+    }
+    if (level == 0) {
+        f(glm::max(brickLo, lo), glm::min(brickHi, hi));
+        return;
+    }
+
+    const glm::ivec3 first = brick << BRICK_BITS;
+    const glm::ivec3 last = glm::min(first + BRICK_SIZE, sizes[level - 1]);
+    for (int x = first.x; x < last.x; x++) {
+        for (int y = first.y; y < last.y; y++) {
+            for (int z = first.z; z < last.z; z++) {
+                forEachBrick(level - 1, glm::ivec3(x, y, z), lo, hi, f);
+            }
+        }
+    }
+}
+
+
+#endif // BRICKMAP_H
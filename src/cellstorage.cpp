@@ -0,0 +1,324 @@
+
+#include "cellstorage.h"
+
+#include <algorithm>
+
+
+namespace {
+// Smallest of the widths 0, 1, 2, 4, 8, 16 which can index a palette of the given size.
+int bitsForPalette(size_t size) {
+    int bits = 0;
+    while (((size_t)1 << bits) < size) {
+        bits = bits == 0 ? 1 : 2 * bits;
+    }
+    return bits;
+}
+}
+
+
+CellIndexer::CellIndexer(int xSize, int ySize, int zSize, CellLayout layout) : 
+        layout(layout),
+        xOffsets(xSize), 
+        yOffsets(ySize), 
+        zOffsets(zSize)
+{
+    if (layout == CellLayout::LINEAR) {
+        count = (size_t)xSize * ySize * zSize;
+        for (int x = 0; x < xSize; x++) xOffsets[x] = x * ySize * zSize;
+        for (int y = 0; y < ySize; y++) yOffsets[y] = y * zSize;
+        for (int z = 0; z < zSize; z++) zOffsets[z] = z;
+        return;
+    }
+
+    // The tile part of the index is a multiple of the tile size and the Morton parts of the axes use
+    // disjoint bits, so the offsets of the axes can be added.
+    const int TILE_BITS = 4;
+    const int tileCells = 1 << (3 * TILE_BITS);
+    const int mask = (1 << TILE_BITS) - 1;
+    const int xTiles = (xSize + mask) >> TILE_BITS;
+    const int yTiles = (ySize + mask) >> TILE_BITS;
+    const int zTiles = (zSize + mask) >> TILE_BITS;
+    count = (size_t)xTiles * yTiles * zTiles * tileCells;
+
+    auto spread = [](int v, int shift) {
+        int bits = 0;
+        for (int b = 0; b < TILE_BITS; b++) {
+            bits |= ((v >> b) & 1) << (3 * b + shift);
+        }
+        return bits;
+    };
+    for (int x = 0; x < xSize; x++) xOffsets[x] = (x >> TILE_BITS) * yTiles * zTiles * tileCells + spread(x & mask, 2);
+    for (int y = 0; y < ySize; y++) yOffsets[y] = (y >> TILE_BITS) * zTiles * tileCells + spread(y & mask, 1);
+    for (int z = 0; z < zSize; z++) zOffsets[z] = (z >> TILE_BITS) * tileCells + spread(z & mask, 0);
+}
+
+
+CellStorage::CellStorage(CellType type, size_t count) : type(type), count(count) {
+    switch (type) {
+        case CellType::UINT8:  cells8.resize(count); break;
+        case CellType::UINT16: cells16.resize(count); break;
+        case CellType::UINT32: cells32.resize(count); break;
+        case CellType::PALETTE_PACKED:
+            bricks.resize((count + BRICK_CELLS - 1) >> BRICK_BITS);
+            for (size_t b = 0; b < bricks.size(); b++) {
+                collapse(bricks[b], 0, brickCells(b));
+            }
+            break;
+    }
+}
+
+
+size_t CellStorage::memoryUsage() const {
+    size_t bytes = cells8.size() + 2 * cells16.size() + 4 * cells32.size();
+    for (const Brick &brick : bricks) {
+        bytes += sizeof(Brick) + 4 * brick.palette.size() + 2 * brick.counts.size() + 4 * brick.words.size();
+    }
+    return bytes;
+}
+
+
+void CellStorage::fill(size_t first, size_t n, unsigned int value) {
+    switch (type) {
+        case CellType::UINT8:  std::fill_n(cells8.begin() + first, n, (uint8_t)value); break;
+        case CellType::UINT16: std::fill_n(cells16.begin() + first, n, (uint16_t)value); break;
+        case CellType::UINT32: std::fill_n(cells32.begin() + first, n, (uint32_t)value); break;
+        default: {
+            const size_t end = first + n;
+            size_t i = first;
+            while (i < end) {
+                const size_t b = i >> BRICK_BITS;
+                const size_t brickStart = b << BRICK_BITS;
+                const size_t brickEnd = brickStart + brickCells(b);
+                if (i == brickStart && end >= brickEnd) {
+                    collapse(bricks[b], value, brickCells(b));
+                    i = brickEnd;
+                    continue;
+                }
+                for (const size_t stop = std::min(end, brickEnd); i < stop; i++) {
+                    setPacked(i, value);
+                }
+            }
+            break;
+        }
+    }
+}
+
+
+void CellStorage::read(size_t first, size_t n, unsigned int* out) const {
+    switch (type) {
+        case CellType::UINT8:  std::copy_n(cells8.begin() + first, n, out); break;
+        case CellType::UINT16: std::copy_n(cells16.begin() + first, n, out); break;
+        case CellType::UINT32: std::copy_n(cells32.begin() + first, n, out); break;
+        default:
+            for (size_t i = 0; i < n; i++) {
+                out[i] = getPacked(first + i);
+            }
+            break;
+    }
+}
+
+
+void CellStorage::write(size_t first, size_t n, const unsigned int* values) {
+    switch (type) {
+        case CellType::UINT8:  std::copy_n(values, n, cells8.begin() + first); break;
+        case CellType::UINT16: std::copy_n(values, n, cells16.begin() + first); break;
+        case CellType::UINT32: std::copy_n(values, n, cells32.begin() + first); break;
+        default:
+            for (size_t i = 0; i < n; i++) {
+                setPacked(first + i, values[i]);
+            }
+            break;
+    }
+}
+
+
+void CellStorage::setType(CellType newType) {
+    if (newType == type) return;
+    CellStorage converted(newType, count);
+    for (size_t i = 0; i < count; i++) {
+        unsigned int value = get(i);
+        if (value > maxValue(newType)) {
+            throw std::invalid_argument( "Tile index " + std::to_string(value) + " does not fit into the cell type" );
+        }
+        converted.set(i, value);
+    }
+    *this = std::move(converted);
+}
+
+
+int CellStorage::brickCells(size_t brick) const {
+    size_t start = brick << BRICK_BITS;
+    return count - start < (size_t)BRICK_CELLS ? count - start : BRICK_CELLS;
+}
+
+
+void CellStorage::repack(Brick &brick, int bitsPerCell) {
+    Brick packed;
+    packed.bitsPerCell = bitsPerCell;
+    packed.words.resize((BRICK_CELLS * bitsPerCell + 31) / 32);
+    if (brick.bitsPerCell != 0) {
+        for (int cell = 0; cell < BRICK_CELLS; cell++) {
+            writeLocal(packed, cell, readLocal(brick, cell));
+        }
+    }
+    brick.bitsPerCell = bitsPerCell;
+    brick.words.swap(packed.words);
+}
+
+
+void CellStorage::collapse(Brick &brick, unsigned int value, int cells) {
+    brick.bitsPerCell = 0;
+    brick.palette.assign(1, value);
+    brick.counts.assign(1, cells);
+    brick.words.clear();
+    brick.words.shrink_to_fit();
+}
+
+
+void CellStorage::setPacked(size_t i, unsigned int value) {
+    const size_t b = i >> BRICK_BITS;
+    const unsigned int cell = i & (BRICK_CELLS - 1);
+    Brick &brick = bricks[b];
+
+    unsigned int old = brick.bitsPerCell == 0 ? 0 : readLocal(brick, cell);
+    if (brick.palette[old] == value) {
+        return;
+    }
+    brick.counts[old]--;
+
+    // Look up the value, or put it into an unused entry, or append it. The palettes are short, most
+    // terrain bricks hold only a few distinct tiles.
+    unsigned int local = brick.palette.size();
+    unsigned int unused = brick.palette.size();
+    for (unsigned int k = 0; k < brick.palette.size(); k++) {
+        if (brick.palette[k] == value) {
+            local = k;
+            break;
+        }
+        if (brick.counts[k] == 0 && unused == brick.palette.size()) {
+            unused = k;
+        }
+    }
+    if (local == brick.palette.size()) {
+        if (unused < brick.palette.size()) {
+            local = unused;
+            brick.palette[local] = value;
+        } else {
+            brick.palette.push_back(value);
+            brick.counts.push_back(0);
+            int bits = bitsForPalette(brick.palette.size());
+            if (bits != brick.bitsPerCell) {
+                repack(brick, bits);
+            }
+        }
+    }
+
+    brick.counts[local]++;
+    if (brick.counts[local] == brickCells(b)) {
+        collapse(brick, value, brickCells(b));
+    } else {
+        writeLocal(brick, cell, local);
+    }
+}
+
+
+void CellStorage::compact() {
+    for (size_t b = 0; b < bricks.size(); b++) {
+        Brick &brick = bricks[b];
+        if (brick.bitsPerCell == 0) continue;
+
+        std::vector<unsigned int> remap(brick.palette.size());
+        Brick compacted;
+        for (unsigned int k = 0; k < brick.palette.size(); k++) {
+            if (brick.counts[k] == 0) continue;
+            remap[k] = compacted.palette.size();
+            compacted.palette.push_back(brick.palette[k]);
+            compacted.counts.push_back(brick.counts[k]);
+        }
+        if (compacted.palette.size() == 1) {
+            collapse(brick, compacted.palette[0], brickCells(b));
+            continue;
+        }
+
+        compacted.bitsPerCell = bitsForPalette(compacted.palette.size());
+        compacted.words.resize((BRICK_CELLS * compacted.bitsPerCell + 31) / 32);
+        for (int cell = 0; cell < brickCells(b); cell++) {
+            writeLocal(compacted, cell, remap[readLocal(brick, cell)]);
+        }
+        brick = std::move(compacted);
+    }
+}
+
+
+std::vector<uint8_t> CellStorage::encodeRuns() const {
+    std::vector<uint8_t> runs;
+    auto put = [&](uint64_t v) {
+        while (v >= 0x80) {
+            runs.push_back((uint8_t)(v | 0x80));
+            v >>= 7;
+        }
+        runs.push_back((uint8_t)v);
+    };
+
+    // Cells are read in blocks to go through the type switch once per block.
+    const size_t BLOCK = 256;
+    unsigned int block[BLOCK];
+    unsigned int runValue = 0;
+    uint64_t runLength = 0;
+    for (size_t first = 0; first < count; first += BLOCK) {
+        const size_t n = std::min(BLOCK, count - first);
+        read(first, n, block);
+        for (size_t i = 0; i < n; i++) {
+            if (runLength > 0 && block[i] == runValue) {
+                runLength++;
+                continue;
+            }
+            if (runLength > 0) {
+                put(runLength);
+                put(runValue);
+            }
+            runValue = block[i];
+            runLength = 1;
+        }
+    }
+    if (runLength > 0) {
+        put(runLength);
+        put(runValue);
+    }
+    return runs;
+}
+
+
+CellStorage CellStorage::decodeRuns(CellType type, size_t count, const uint8_t* runs, size_t size) {
+    size_t pos = 0;
+    auto next = [&]() {
+        uint64_t v = 0;
+        for (int shift = 0; pos < size && shift < 64; shift += 7) {
+            const uint8_t byte = runs[pos++];
+            v |= (uint64_t)(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                return v;
+            }
+        }
+        throw std::invalid_argument( "Truncated run-length data" );
+    };
+
+    // New storage is empty, only runs of other values are written.
+    CellStorage cells(type, count);
+    size_t i = 0;
+    while (pos < size) {
+        const uint64_t length = next();
+        const uint64_t value = next();
+        if (length > count - i || value > maxValue(type)) {
+            throw std::invalid_argument( "Run-length data does not match " + std::to_string(count) + " cells" );
+        }
+        if (value != 0) {
+            cells.fill(i, length, (unsigned int)value);
+        }
+        i += length;
+    }
+    if (i != count) {
+        throw std::invalid_argument( "Run-length data does not match " + std::to_string(count) + " cells" );
+    }
+    return cells;
+}
@@ -0,0 +1,179 @@
+#ifndef CELLSTORAGE_H
+#define CELLSTORAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+// Storage of the palette indices of a tilemap.
+enum class CellType {
+    UINT8,
+    UINT16,
+    UINT32,
+    // Bricks of BRICK_CELLS consecutive cells with their own small palette, indices into it are
+    // bit-packed with 1, 2, 4, 8 or 16 bits. Bricks holding a single value store no array.
+    PALETTE_PACKED
+};
+
+
+// Order of the cells of a 3d map in its storage.
+enum class CellLayout {
+    // x-major: index = (x * ySize + y) * zSize + z
+    LINEAR,
+    // Z-order (Morton) curve inside tiles of 16^3 cells, tiles in x-major order. Sizes are padded
+    // to multiples of 16. A tile is exactly one brick of PALETTE_PACKED storage.
+    MORTON
+};
+
+
+// Maps in-bounds cell coordinates to storage indices with one table lookup per axis, for either
+// layout. No bounds checks.
+class CellIndexer {
+    public:
+        CellIndexer(int xSize = 0, int ySize = 0, int zSize = 0, CellLayout layout = CellLayout::LINEAR);
+
+        CellLayout getLayout() const {return layout;}
+        // Number of cells including the padding of the layout.
+        size_t cellCount() const {return count;}
+
+        int operator()(int x, int y, int z) const {
+            return xOffsets[x] + yOffsets[y] + zOffsets[z];
+        }
+
+    private:
+        CellLayout layout;
+        size_t count;
+        std::vector<int> xOffsets, yOffsets, zOffsets;
+};
+
+
+// Array of palette indices with a cell type chosen at runtime. Only the storage of the current
+// type holds data.
+class CellStorage {
+    public:
+        static const int BRICK_BITS = 12;
+        static const int BRICK_CELLS = 1 << BRICK_BITS;
+
+        CellStorage(CellType type = CellType::UINT32, size_t count = 0);
+
+        CellType getType() const {return type;}
+        size_t size() const {return count;}
+        // Bytes used by the cell data.
+        size_t memoryUsage() const;
+
+        unsigned int get(size_t i) const {
+            switch (type) {
+                case CellType::UINT8:  return cells8[i];
+                case CellType::UINT16: return cells16[i];
+                case CellType::UINT32: return cells32[i];
+                default:               return getPacked(i);
+            }
+        }
+
+        // value must fit into the cell type, see maxValue.
+        void set(size_t i, unsigned int value) {
+            switch (type) {
+                case CellType::UINT8:  cells8[i] = value; break;
+                case CellType::UINT16: cells16[i] = value; break;
+                case CellType::UINT32: cells32[i] = value; break;
+                default:               setPacked(i, value); break;
+            }
+        }
+
+        // Cells [first, first + n) as one span. Packed bricks covered completely by a fill are collapsed
+        // without touching their cells. Values must fit into the cell type.
+        void fill(size_t first, size_t n, unsigned int value);
+        void read(size_t first, size_t n, unsigned int* out) const;
+        void write(size_t first, size_t n, const unsigned int* values);
+        // Cell array of the current type for bulk loaders: uint8_t, uint16_t or uint32_t for UINT8, UINT16
+        // and UINT32. Null if T does not match the type.
+        template <class T>
+        T* data();
+
+        // Converts the stored cells. Throws if a value does not fit into the new type.
+        void setType(CellType newType);
+
+        // Drops unused entries of the brick palettes and packs the bricks with the smallest bit width.
+        // Only useful with PALETTE_PACKED after many edits.
+        void compact();
+
+        // Run-length encoding of all cells as pairs of run length and value, both as 7 bit varints.
+        // Independent of the cell type.
+        std::vector<uint8_t> encodeRuns() const;
+        // Cells from encodeRuns. Throws if the runs do not cover exactly count cells or a value does not
+        // fit into the type.
+        static CellStorage decodeRuns(CellType type, size_t count, const uint8_t* runs, size_t size);
+        static CellStorage decodeRuns(CellType type, size_t count, const std::vector<uint8_t> &runs) {
+            return decodeRuns(type, count, runs.data(), runs.size());
+        }
+
+        static unsigned int maxValue(CellType type) {
+            switch (type) {
+                case CellType::UINT8:  return UINT8_MAX;
+                case CellType::UINT16: return UINT16_MAX;
+                default:               return UINT32_MAX;
+            }
+        }
+
+        // Smallest array type which holds the indices of a palette with paletteSize entries.
+        static CellType narrowestType(size_t paletteSize) {
+            if (paletteSize <= (size_t)UINT8_MAX + 1) return CellType::UINT8;
+            if (paletteSize <= (size_t)UINT16_MAX + 1) return CellType::UINT16;
+            return CellType::UINT32;
+        }
+
+    private:
+        // The palette maps local indices to values, counts holds the number of cells per local index.
+        // Unused entries are reused before the palette grows.
+        struct Brick {
+            int bitsPerCell = 0;
+            std::vector<unsigned int> palette;
+            std::vector<uint16_t> counts;
+            std::vector<uint32_t> words;
+        };
+
+        CellType type;
+        size_t count;
+        std::vector<uint8_t> cells8;
+        std::vector<uint16_t> cells16;
+        std::vector<uint32_t> cells32;
+        std::vector<Brick> bricks;
+
+        int brickCells(size_t brick) const;
+
+        static unsigned int readLocal(const Brick &brick, unsigned int cell) {
+            unsigned int bit = cell * brick.bitsPerCell;
+            return (brick.words[bit >> 5] >> (bit & 31)) & ((1u << brick.bitsPerCell) - 1);
+        }
+        static void writeLocal(Brick &brick, unsigned int cell, unsigned int local) {
+            unsigned int bit = cell * brick.bitsPerCell;
+            uint32_t mask = ((1u << brick.bitsPerCell) - 1) << (bit & 31);
+            uint32_t &word = brick.words[bit >> 5];
+            word = (word & ~mask) | (local << (bit & 31));
+        }
+        static void repack(Brick &brick, int bitsPerCell);
+        static void collapse(Brick &brick, unsigned int value, int cells);
+
+        unsigned int getPacked(size_t i) const {
+            const Brick &brick = bricks[i >> BRICK_BITS];
+            if (brick.bitsPerCell == 0) {
+                return brick.palette[0];
+            }
+            return brick.palette[readLocal(brick, i & (BRICK_CELLS - 1))];
+        }
+        void setPacked(size_t i, unsigned int value);
+};
+
+
+template <>
+inline uint8_t* CellStorage::data<uint8_t>() {return type == CellType::UINT8 ? cells8.data() : nullptr;}
+template <>
+inline uint16_t* CellStorage::data<uint16_t>() {return type == CellType::UINT16 ? cells16.data() : nullptr;}
+template <>
+inline uint32_t* CellStorage::data<uint32_t>() {return type == CellType::UINT32 ? cells32.data() : nullptr;}
+
+
+#endif // CELLSTORAGE_H
@@ -0,0 +1,418 @@
+
+#include "chunkedtilemap3d.h"
+#include "voxelmesher.h"
+
+#include <algorithm>
+
+
+ChunkedTileMap3d::ChunkedTileMap3d(const Palette palette) : palette(palette)
+{
+}
+
+ChunkedTileMap3d::~ChunkedTileMap3d() {
+    for (auto& it : chunks) {
+        if (it.second.meshID != 0) {
+            Renderer::deleteMesh(it.second.meshID);
+        }
+    }
+}
+
+
+ChunkedTileMap3d::Chunk* ChunkedTileMap3d::findChunk(glm::ivec3 chunk) {
+    auto it = chunks.find(chunk);
+    if (it == chunks.end()) {
+        return nullptr;
+    }
+    return &it->second;
+}
+
+void ChunkedTileMap3d::touch(Chunk &chunk) {
+    chunk.lastUse = frame;
+    if (!chunk.compressed) {
+        hits++;
+        return;
+    }
+    misses++;
+    chunk.content = CellStorage::decodeRuns(chunk.content.getType(), CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE, chunk.runs);
+    std::vector<uint8_t>().swap(chunk.runs);
+    chunk.compressed = false;
+}
+
+void ChunkedTileMap3d::compress(Chunk &chunk) {
+    std::vector<uint8_t> runs = chunk.content.encodeRuns();
+    if (runs.size() >= chunk.content.memoryUsage()) {
+        // Not worth it, try again when the chunk is cold the next time.
+        chunk.lastUse = frame;
+        return;
+    }
+    chunk.runs = std::move(runs);
+    chunk.content = CellStorage(chunk.content.getType(), 0);
+    chunk.compressed = true;
+    compressions++;
+}
+
+void ChunkedTileMap3d::markOutdated(glm::ivec3 chunk) {
+    Chunk* c = findChunk(chunk);
+    if (c != nullptr) {
+        c->meshOutdated = true;
+    }
+}
+
+
+void ChunkedTileMap3d::markNeighboursOutdated(glm::ivec3 chunk) {
+    for (int a = 0; a < 3; a++) {
+        for (int d = -1; d <= 1; d += 2) {
+            glm::ivec3 neighbour = chunk;
+            neighbour[a] += d;
+            markOutdated(neighbour);
+        }
+    }
+}
+
+
+void ChunkedTileMap3d::insertChunk(glm::ivec3 key, CellStorage content) {
+    if (content.size() != (size_t)(CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE)) {
+        throw std::invalid_argument( "Chunk content must have " + std::to_string(CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE) + " cells" );
+    }
+    int solidCount = 0;
+    unsigned int maxValue = 0;
+    for (size_t i = 0; i < content.size(); i++) {
+        const unsigned int value = content.get(i);
+        solidCount += value != 0;
+        maxValue = std::max(maxValue, value);
+    }
+    if (maxValue >= palette.size()) {
+        throw std::invalid_argument( "Tile index " + std::to_string(maxValue) + " out of range: 0 - " + std::to_string(palette.size()) );
+    }
+
+    if (solidCount == 0) {
+        removeChunk(key);
+        return;
+    }
+    Chunk &chunk = chunks[key];
+    chunk.content = std::move(content);
+    std::vector<uint8_t>().swap(chunk.runs);
+    chunk.compressed = false;
+    chunk.lastUse = frame;
+    chunk.solidCount = solidCount;
+    chunk.meshOutdated = true;
+    markNeighboursOutdated(key);
+}
+
+
+void ChunkedTileMap3d::removeChunk(glm::ivec3 key) {
+    auto it = chunks.find(key);
+    if (it == chunks.end()) {
+        return;
+    }
+    if (it->second.meshID != 0) {
+        Renderer::deleteMesh(it->second.meshID);
+    }
+    chunks.erase(it);
+    markNeighboursOutdated(key);
+}
+
+
+std::vector<glm::ivec3> ChunkedTileMap3d::getChunkKeys() const {
+    std::vector<glm::ivec3> keys;
+    keys.reserve(chunks.size());
+    for (auto& it : chunks) {
+        keys.push_back(it.first);
+    }
+    return keys;
+}
+
+
+const CellStorage& ChunkedTileMap3d::getChunkCells(glm::ivec3 key) {
+    Chunk* chunk = findChunk(key);
+    if (chunk == nullptr) {
+        throw std::invalid_argument( "No chunk at " + std::to_string(key.x) + ", " + std::to_string(key.y) + ", " + std::to_string(key.z) );
+    }
+    touch(*chunk);
+    return chunk->content;
+}
+
+
+bool ChunkedTileMap3d::isMeshOutdated(glm::ivec3 key) const {
+    auto it = chunks.find(key);
+    return it != chunks.end() && it->second.meshOutdated;
+}
+
+
+size_t ChunkedTileMap3d::chunkMemoryUsage(glm::ivec3 key) const {
+    auto it = chunks.find(key);
+    if (it == chunks.end()) {
+        return 0;
+    }
+    const Chunk &chunk = it->second;
+    size_t bytes = chunk.compressed ? chunk.runs.size() : chunk.content.memoryUsage();
+    if (chunk.meshID != 0) {
+        bytes += 2 * Renderer::getMesh(chunk.meshID)->memoryUsage();
+    }
+    return bytes;
+}
+
+
+unsigned int ChunkedTileMap3d::get(int x, int y, int z) {
+    Chunk* chunk = findChunk(chunkCoord(glm::ivec3(x, y, z)));
+    if (chunk == nullptr) {
+        return 0;
+    }
+    touch(*chunk);
+    return chunk->content.get(localIndex(x, y, z));
+}
+
+unsigned int ChunkedTileMap3d::get(glm::ivec3 k) {
+    return get(k.x, k.y, k.z);
+}
+
+Tile ChunkedTileMap3d::getTile(int x, int y, int z) {
+    return palette[get(x, y, z)];
+}
+
+Tile ChunkedTileMap3d::getTile(glm::ivec3 k) {
+    return getTile(k.x, k.y, k.z);
+}
+
+
+void ChunkedTileMap3d::set(int x, int y, int z, unsigned int value) {
+    if (value >= palette.size()) {
+        throw std::invalid_argument( "Tile index " + std::to_string(value) + " out of range: 0 - " + std::to_string(palette.size()) );
+    }
+    const glm::ivec3 key = chunkCoord(glm::ivec3(x, y, z));
+    Chunk* chunk = findChunk(key);
+    if (chunk == nullptr) {
+        if (value == 0) {
+            return;
+        }
+        chunk = &chunks[key];
+        chunk->content = CellStorage(CellStorage::narrowestType(palette.size()), CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE);
+    }
+    touch(*chunk);
+    if (value > CellStorage::maxValue(chunk->content.getType())) {
+        chunk->content.setType(CellStorage::narrowestType(palette.size()));
+    }
+
+    const int i = localIndex(x, y, z);
+    unsigned int cell = chunk->content.get(i);
+    if (cell == value) {
+        return;
+    }
+    chunk->solidCount += (value != 0) - (cell != 0);
+    chunk->content.set(i, value);
+    chunk->meshOutdated = true;
+
+    // Faces of neighbouring chunks which touch this voxel may have changed visibility.
+    const int mask = CHUNK_SIZE - 1;
+    if ((x & mask) == 0)    markOutdated(key + glm::ivec3(-1, 0, 0));
+    if ((x & mask) == mask) markOutdated(key + glm::ivec3( 1, 0, 0));
+    if ((y & mask) == 0)    markOutdated(key + glm::ivec3(0, -1, 0));
+    if ((y & mask) == mask) markOutdated(key + glm::ivec3(0,  1, 0));
+    if ((z & mask) == 0)    markOutdated(key + glm::ivec3(0, 0, -1));
+    if ((z & mask) == mask) markOutdated(key + glm::ivec3(0, 0,  1));
+
+    if (chunk->solidCount == 0) {
+        if (chunk->meshID != 0) {
+            Renderer::deleteMesh(chunk->meshID);
+        }
+        chunks.erase(key);
+    }
+}
+
+void ChunkedTileMap3d::set(glm::ivec3 k, unsigned int v) {
+    set(k.x, k.y, k.z, v);
+}
+
+
+namespace {
+// Voxel source for the mesher. Coordinates are local to the chunk; neighbours outside the chunk
+// are looked up in the face neighbours, which is all the mesher needs. Only reads resident chunks,
+// so several sources can be used at once.
+struct ChunkSource {
+    const ChunkedTileMap3d::Chunk* chunk;
+    // [axis][0] below and [axis][1] above the chunk, null if not allocated.
+    const ChunkedTileMap3d::Chunk* neighbours[3][2];
+
+    glm::ivec3 size() const {
+        return glm::ivec3(ChunkedTileMap3d::CHUNK_SIZE);
+    }
+    unsigned int get(int x, int y, int z) const {
+        return chunk->content.get(ChunkedTileMap3d::localIndex(x, y, z));
+    }
+    bool isEmpty(int x, int y, int z) const {
+        const int s = ChunkedTileMap3d::CHUNK_SIZE;
+        const glm::ivec3 p(x, y, z);
+        for (int a = 0; a < 3; a++) {
+            if (p[a] < 0 || p[a] >= s) {
+                const ChunkedTileMap3d::Chunk* neighbour = neighbours[a][p[a] >= s];
+                return neighbour == nullptr || neighbour->content.get(ChunkedTileMap3d::localIndex(x, y, z)) == 0;
+            }
+        }
+        return get(x, y, z) == 0;
+    }
+};
+}
+
+
+void ChunkedTileMap3d::updateChunkMesh(Chunk &chunk, VoxelMesher::MeshBuffer &buffer) {
+    if (buffer.packed) {
+        std::vector<glm::vec4> colors = VoxelMesher::packedPalette(palette);
+        if (chunk.meshID == 0) {
+            chunk.meshID = Renderer::newMesh(buffer.packedVertices, buffer.indices, colors);
+        } else {
+            Renderer::updateMesh(chunk.meshID, buffer.packedVertices, buffer.indices, colors);
+        }
+    } else if (chunk.meshID == 0) {
+        chunk.meshID = Renderer::newMesh(buffer.vertices, buffer.indices);
+    } else {
+        Renderer::updateMesh(chunk.meshID, buffer.vertices, buffer.indices);
+    }
+    chunk.meshOutdated = false;
+}
+
+
+void ChunkedTileMap3d::updateMeshes() {
+    std::vector<std::pair<glm::ivec3, Chunk*>> outdated;
+    for (auto& it : chunks) {
+        if (it.second.meshOutdated) {
+            outdated.emplace_back(it.first, &it.second);
+        }
+    }
+    if (outdated.empty()) {
+        return;
+    }
+    meshChunks(outdated);
+}
+
+
+void ChunkedTileMap3d::updateMeshes(const std::vector<glm::ivec3> &keys) {
+    std::vector<std::pair<glm::ivec3, Chunk*>> outdated;
+    for (glm::ivec3 key : keys) {
+        Chunk* chunk = findChunk(key);
+        if (chunk != nullptr && chunk->meshOutdated) {
+            outdated.emplace_back(key, chunk);
+        }
+    }
+    meshChunks(outdated);
+}
+
+
+void ChunkedTileMap3d::meshChunks(std::vector<std::pair<glm::ivec3, Chunk*>> &outdated) {
+    if (outdated.empty()) {
+        return;
+    }
+
+    // The mesher reads the outdated chunks and their neighbours from several threads, so they are
+    // decoded beforehand.
+    std::vector<ChunkSource> sources(outdated.size());
+    for (unsigned int i = 0; i < outdated.size(); i++) {
+        touch(*outdated[i].second);
+        sources[i].chunk = outdated[i].second;
+        for (int a = 0; a < 3; a++) {
+            for (int side = 0; side < 2; side++) {
+                glm::ivec3 key = outdated[i].first;
+                key[a] += side == 0 ? -1 : 1;
+                Chunk* neighbour = findChunk(key);
+                if (neighbour != nullptr) {
+                    touch(*neighbour);
+                }
+                sources[i].neighbours[a][side] = neighbour;
+            }
+        }
+    }
+
+    // Chunks are meshed in parallel, the meshes are handed to the renderer on this thread.
+    const bool packed = packedVertices && VoxelMesher::canPack(palette, glm::ivec3(CHUNK_SIZE));
+    std::vector<VoxelMesher::MeshBuffer> buffers(outdated.size());
+    ThreadPool::shared().parallelFor(outdated.size(), [&](int i) {
+        buffers[i].packed = packed;
+        OccupancyMask occupancy;
+        occupancy.build(sources[i]);
+        VoxelMesher::generate(sources[i], meshingMode, palette, glm::vec3(0.0f), buffers[i], &occupancy);
+    });
+    for (unsigned int i = 0; i < outdated.size(); i++) {
+        updateChunkMesh(*outdated[i].second, buffers[i]);
+    }
+}
+
+
+std::vector<MeshRenderObject> ChunkedTileMap3d::getRenderables(bool remesh) {
+    if (remesh) {
+        updateMeshes();
+    }
+    std::vector<MeshRenderObject> renderables;
+    renderables.reserve(chunks.size());
+    for (auto& it : chunks) {
+        if (it.second.meshID == 0) continue;
+        MeshRenderObject meshInstance;
+        meshInstance.meshID = it.second.meshID;
+        meshInstance.transform = Transform(glm::vec3(it.first * CHUNK_SIZE));
+        renderables.emplace_back(meshInstance);
+    }
+    return renderables;
+}
+
+
+void ChunkedTileMap3d::compressColdChunks() {
+    frame++;
+    std::vector<Chunk*> resident;
+    size_t residentBytes = 0;
+    for (auto& it : chunks) {
+        Chunk &chunk = it.second;
+        if (chunk.compressed) continue;
+        if (frame - chunk.lastUse > (uint64_t)coldFrames) {
+            compress(chunk);
+            if (chunk.compressed) continue;
+        }
+        resident.push_back(&chunk);
+        residentBytes += chunk.content.memoryUsage();
+    }
+    if (residentBytes <= memoryBudget) {
+        return;
+    }
+
+    // Least recently used first.
+    std::sort(resident.begin(), resident.end(), [](const Chunk* a, const Chunk* b) {
+        return a->lastUse < b->lastUse;
+    });
+    for (Chunk* chunk : resident) {
+        if (residentBytes <= memoryBudget) break;
+        const size_t bytes = chunk->content.memoryUsage();
+        compress(*chunk);
+        if (chunk->compressed) {
+            residentBytes -= bytes;
+        }
+    }
+}
+
+
+void ChunkedTileMap3d::decompressAll() {
+    for (auto& it : chunks) {
+        if (it.second.compressed) {
+            touch(it.second);
+        }
+    }
+}
+
+
+ChunkedTileMap3d::CompressionStats ChunkedTileMap3d::getCompressionStats() const {
+    CompressionStats stats;
+    stats.hits = hits;
+    stats.misses = misses;
+    stats.compressions = compressions;
+    for (auto& it : chunks) {
+        if (it.second.compressed) {
+            stats.compressedChunks++;
+            stats.compressedBytes += it.second.runs.size();
+        } else {
+            stats.residentChunks++;
+            stats.residentBytes += it.second.content.memoryUsage();
+        }
+    }
+    return stats;
+}
+
+
+void ChunkedTileMap3d::resetCompressionCounters() {
+    hits = misses = compressions = 0;
+}
@@ -0,0 +1,141 @@
+#ifndef CHUNKEDTILEMAP3D_H
+#define CHUNKEDTILEMAP3D_H
+
+#include <glm/vec3.hpp> // glm::vec3
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include "mesh.h"
+#include "rendercomponent.h"
+#include "tilemap3d.h"
+
+
+namespace VoxelMesher {
+struct MeshBuffer;
+}
+
+
+struct ChunkKeyHash {
+    size_t operator()(const glm::ivec3 &k) const {
+        return ((size_t)k.x * 73856093) ^ ((size_t)k.y * 19349663) ^ ((size_t)k.z * 83492791);
+    }
+};
+
+
+// Unbounded sparse tilemap. Voxels are stored in chunks of CHUNK_SIZE^3 which are only allocated
+// once they contain a non-empty voxel and are freed again when they become empty. Every chunk owns
+// its own mesh, so edits only remesh the chunks they touch.
+// Like TileMap3d, palette index 0 is reserved for empty voxels.
+// Chunks which are not accessed for a while are run-length encoded by compressColdChunks and decoded
+// again by the next access, so resident memory follows the working set. Because of that, even get
+// changes the map and must not be called from several threads at once.
+class ChunkedTileMap3d {
+    public:
+        static const int CHUNK_BITS = 5;
+        static const int CHUNK_SIZE = 1 << CHUNK_BITS;
+
+        MeshingMode meshingMode = MeshingMode::NAIVE;
+        bool packedVertices = false;
+
+        // compressColdChunks encodes chunks not accessed during the last coldFrames frames, and more of
+        // the least recently used ones while the resident cells take more than memoryBudget bytes.
+        int coldFrames = 300;
+        size_t memoryBudget = SIZE_MAX;
+
+        struct CompressionStats {
+            // Accesses of resident and of compressed chunks, the latter decode the chunk.
+            size_t hits = 0, misses = 0;
+            size_t compressions = 0;
+            int residentChunks = 0, compressedChunks = 0;
+            // Bytes of cell data.
+            size_t residentBytes = 0, compressedBytes = 0;
+        };
+
+        ChunkedTileMap3d(const Palette palette);
+        ~ChunkedTileMap3d();
+
+        ChunkedTileMap3d(const ChunkedTileMap3d &other) = delete;
+        ChunkedTileMap3d& operator=(const ChunkedTileMap3d &other) = delete;
+
+        unsigned int get(int x, int y, int z);
+        unsigned int get(glm::ivec3 k);
+
+        Tile getTile(int x, int y, int z);
+        Tile getTile(glm::ivec3 k);
+
+        void set(int x, int y, int z, unsigned int value);
+        void set(glm::ivec3 k, unsigned int v);
+
+        // Remeshes all chunks which were changed since the last call, in parallel.
+        void updateMeshes();
+        // Same for the given chunks only, if they are outdated.
+        void updateMeshes(const std::vector<glm::ivec3> &keys);
+
+        // One mesh per chunk, placed at the chunk origin. Outdated chunks are remeshed first unless
+        // remesh is false, e.g. because a WorldStreamer updates the meshes.
+        std::vector<MeshRenderObject> getRenderables(bool remesh = true);
+
+        // Call once per frame. Starts a new frame and compresses cold chunks as configured by coldFrames
+        // and memoryBudget.
+        void compressColdChunks();
+        // Decodes all compressed chunks.
+        void decompressAll();
+        CompressionStats getCompressionStats() const;
+        void resetCompressionCounters();
+
+        int chunkCount() {return chunks.size();}
+
+        // Streaming of whole chunks. insertChunk replaces the cells of a chunk, content holds
+        // CHUNK_SIZE^3 cells in localIndex order and is dropped if they are all empty. removeChunk
+        // frees the cells and the mesh of a chunk. Both mark the neighbours for remeshing.
+        void insertChunk(glm::ivec3 key, CellStorage content);
+        void removeChunk(glm::ivec3 key);
+        bool hasChunk(glm::ivec3 key) const {return chunks.count(key) != 0;}
+        std::vector<glm::ivec3> getChunkKeys() const;
+        // Cells of an existing chunk in localIndex order, decoded if the chunk is compressed.
+        const CellStorage& getChunkCells(glm::ivec3 key);
+        bool isMeshOutdated(glm::ivec3 key) const;
+        // Bytes of the cells of a chunk, compressed or not, and of its mesh on the CPU and the GPU.
+        size_t chunkMemoryUsage(glm::ivec3 key) const;
+
+        static glm::ivec3 chunkCoord(glm::ivec3 k) {
+            return glm::ivec3(k.x >> CHUNK_BITS, k.y >> CHUNK_BITS, k.z >> CHUNK_BITS);
+        }
+        static int localIndex(int x, int y, int z) {
+            const int mask = CHUNK_SIZE - 1;
+            return ((x & mask) << (2 * CHUNK_BITS)) | ((y & mask) << CHUNK_BITS) | (z & mask);
+        }
+
+        struct Chunk {
+            // Cell type is the narrowest one for the palette at the time the chunk is allocated.
+            CellStorage content;
+            // CellStorage::encodeRuns of the cells while the chunk is compressed, content is then empty.
+            std::vector<uint8_t> runs;
+            bool compressed = false;
+            uint64_t lastUse = 0;
+            int solidCount = 0;
+            Renderer::MeshID meshID = 0;
+            bool meshOutdated = true;
+        };
+
+        Palette palette;
+
+    private:
+        std::unordered_map<glm::ivec3, Chunk, ChunkKeyHash> chunks;
+        uint64_t frame = 0;
+        size_t hits = 0, misses = 0, compressions = 0;
+
+        Chunk* findChunk(glm::ivec3 chunk);
+        // Makes the cells of a chunk resident and counts the access.
+        void touch(Chunk &chunk);
+        void compress(Chunk &chunk);
+        void markOutdated(glm::ivec3 chunk);
+        void markNeighboursOutdated(glm::ivec3 chunk);
+        void updateChunkMesh(Chunk &chunk, VoxelMesher::MeshBuffer &buffer);
+        void meshChunks(std::vector<std::pair<glm::ivec3, Chunk*>> &outdated);
+};
+
+
+#endif // CHUNKEDTILEMAP3D_H
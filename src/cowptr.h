@@ -0,0 +1,49 @@
+#ifndef COWPTR_H
+#define COWPTR_H
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+
+
+// Value shared by all copies of the handle until one of them writes to it, which then gets its
+// own copy. Every write gives the value a new stamp, so handles with equal stamps hold equal values.
+// Copying a handle must not race with a write through another handle to the same value.
+template <class T>
+class CowPtr {
+    public:
+        CowPtr() : block(std::make_shared<Block>(T())) {}
+        CowPtr(T value) : block(std::make_shared<Block>(std::move(value))) {}
+
+        const T& operator*() const {return block->value;}
+        const T* operator->() const {return &block->value;}
+
+        // Copies the value first if other handles share it.
+        T& write() {
+            if (block.use_count() > 1) {
+                block = std::make_shared<Block>(block->value);
+            } else {
+                block->stamp = nextStamp();
+            }
+            return block->value;
+        }
+
+        uint64_t stamp() const {return block->stamp;}
+        bool isShared() const {return block.use_count() > 1;}
+
+    private:
+        struct Block {
+            T value;
+            uint64_t stamp;
+            Block(T value) : value(std::move(value)), stamp(nextStamp()) {}
+        };
+        std::shared_ptr<Block> block;
+
+        static uint64_t nextStamp() {
+            static std::atomic<uint64_t> counter(0);
+            return ++counter;
+        }
+};
+
+
+#endif // COWPTR_H
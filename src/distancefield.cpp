@@ -0,0 +1,126 @@
+
+#include "distancefield.h"
+
+#include <cmath>
+#include <limits>
+
+
+namespace {
+const float FAR = 1e20f;
+
+// Squared distance transform of one line of samples f with the given stride, in place. v and z are
+// scratch space for the lower envelope of the parabolas, of at least n and n + 1 entries.
+void transformLine(float* line, int n, int stride, std::vector<float> &f, std::vector<int> &v, std::vector<float> &z) {
+    bool hasFeature = false;
+    for (int q = 0; q < n; q++) {
+        f[q] = line[q * stride];
+        hasFeature |= f[q] < FAR;
+    }
+    if (!hasFeature) {
+        return;
+    }
+
+    int k = 0;
+    v[0] = 0;
+    z[0] = -std::numeric_limits<float>::infinity();
+    z[1] = std::numeric_limits<float>::infinity();
+    for (int q = 1; q < n; q++) {
+        // Intersection of parabola q with the rightmost one of the lower envelope.
+        auto intersection = [&]() {
+            const int p = v[k];
+            return ((f[q] + q * q) - (f[p] + p * p)) / (2.0f * (q - p));
+        };
+        float s = intersection();
+        while (s <= z[k]) {
+            k--;
+            s = intersection();
+        }
+        k++;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = std::numeric_limits<float>::infinity();
+    }
+
+    k = 0;
+    for (int q = 0; q < n; q++) {
+        while (z[k + 1] < q) {
+            k++;
+        }
+        const float d = q - v[k];
+        line[q * stride] = d * d + f[v[k]];
+    }
+}
+}
+
+
+DistanceField::DistanceField(float maxDistance) : maxDistance(maxDistance), scale(127.0f / maxDistance) {
+}
+
+
+void DistanceField::compute(const std::vector<uint8_t> &solid, glm::ivec3 lo, glm::ivec3 extent, glm::ivec3 writeLo, glm::ivec3 writeHi) {
+    const int longest = std::max(extent.x, std::max(extent.y, extent.z));
+    std::vector<float> grid(solid.size());
+
+    // First the distance of empty cells to non-empty ones, then the other way round.
+    for (int pass = 0; pass < 2; pass++) {
+        const uint8_t feature = pass == 0 ? 1 : 0;
+        for (size_t i = 0; i < grid.size(); i++) {
+            grid[i] = solid[i] == feature ? 0.0f : FAR;
+        }
+
+        // One pass per axis, the lines of a pass are independent.
+        ThreadPool::shared().parallelFor(extent.x, [&](int x) {
+            std::vector<float> f(longest), z(longest + 1);
+            std::vector<int> v(longest);
+            for (int y = 0; y < extent.y; y++) {
+                transformLine(&grid[(x * extent.y + y) * extent.z], extent.z, 1, f, v, z);
+            }
+            for (int k = 0; k < extent.z; k++) {
+                transformLine(&grid[x * extent.y * extent.z + k], extent.y, extent.z, f, v, z);
+            }
+        });
+        ThreadPool::shared().parallelFor(extent.y, [&](int y) {
+            std::vector<float> f(longest), z(longest + 1);
+            std::vector<int> v(longest);
+            for (int k = 0; k < extent.z; k++) {
+                transformLine(&grid[y * extent.z + k], extent.x, extent.y * extent.z, f, v, z);
+            }
+        });
+
+        ThreadPool::shared().parallelFor(writeHi.x - writeLo.x, [&](int i) {
+            const int x = writeLo.x + i;
+            for (int y = writeLo.y; y < writeHi.y; y++) {
+                const int row = ((x - lo.x) * extent.y + (y - lo.y)) * extent.z - lo.z;
+                for (int z = writeLo.z; z < writeHi.z; z++) {
+                    if (solid[row + z] == feature) continue;
+                    const float distance = std::min(std::sqrt(grid[row + z]) * scale, 127.0f);
+                    cells[index(x, y, z)] = (int8_t)std::lround(pass == 0 ? distance : -distance);
+                }
+            }
+        });
+    }
+}
+
+
+float DistanceField::sample(glm::vec3 p) const {
+    const glm::vec3 q = glm::clamp(p - 0.5f, glm::vec3(0.0f), glm::vec3(size - 1));
+    const glm::ivec3 a = glm::ivec3(q);
+    const glm::ivec3 b = glm::min(a + 1, size - 1);
+    const glm::vec3 t = q - glm::vec3(a);
+
+    float result = 0.0f;
+    for (int corner = 0; corner < 8; corner++) {
+        const glm::ivec3 c((corner & 1) ? b.x : a.x, (corner & 2) ? b.y : a.y, (corner & 4) ? b.z : a.z);
+        const float weight = ((corner & 1) ? t.x : 1.0f - t.x) * ((corner & 2) ? t.y : 1.0f - t.y) * ((corner & 4) ? t.z : 1.0f - t.z);
+        result += weight * get(c.x, c.y, c.z);
+    }
+    return result;
+}
+
+
+glm::vec3 DistanceField::gradient(glm::vec3 p) const {
+    return glm::vec3(
+        sample(p + glm::vec3(1, 0, 0)) - sample(p - glm::vec3(1, 0, 0)),
+        sample(p + glm::vec3(0, 1, 0)) - sample(p - glm::vec3(0, 1, 0)),
+        sample(p + glm::vec3(0, 0, 1)) - sample(p - glm::vec3(0, 0, 1))) * 0.5f;
+}
@@ -0,0 +1,111 @@
+#ifndef DISTANCEFIELD_H
+#define DISTANCEFIELD_H
+
+#include <glm/vec3.hpp> // glm::vec3, glm::ivec3
+#include <glm/common.hpp> // glm::min, glm::max
+#include <glm/vector_relational.hpp> // glm::any, glm::greaterThanEqual
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+#include "threadpool.h"
+
+
+// Signed Euclidean distance field of the occupancy of a tilemap. Every cell stores the distance
+// from its center to the center of the nearest cell of the other kind, positive in empty and
+// negative in non-empty cells; cells outside the map count as empty. Distances are quantized to
+// 8 bits and clamped to maxDistance.
+// The field is computed with a separable exact distance transform (Felzenszwalb and Huttenlocher),
+// one pass per axis with the lines of a pass spread over the thread pool. After edits, update only
+// recomputes the cells whose clamped distance can change.
+// Works with TileMap3d and TileMap3dT, the maps need getXSize, getYSize, getZSize and getUnchecked.
+class DistanceField {
+    public:
+        DistanceField(float maxDistance = 16.0f);
+
+        template <class Map>
+        void build(const Map &map);
+        // Call after cells in [lo, hi) changed.
+        template <class Map>
+        void update(const Map &map, glm::ivec3 lo, glm::ivec3 hi);
+
+        float getMaxDistance() const {return maxDistance;}
+        glm::ivec3 getSize() const {return size;}
+        size_t memoryUsage() const {return cells.size();}
+
+        // Cell coordinates must lie inside the map.
+        float get(int x, int y, int z) const {
+            return cells[index(x, y, z)] / scale;
+        }
+        // Trilinear interpolation between cell centers at position p in voxel coordinates, i.e. cell
+        // (x, y, z) has its center at (x + 0.5, y + 0.5, z + 0.5). Clamped to the map.
+        float sample(glm::vec3 p) const;
+        // Central differences of sample, points away from non-empty cells. Not normalized.
+        glm::vec3 gradient(glm::vec3 p) const;
+
+    private:
+        float maxDistance;
+        // Quantization steps per voxel.
+        float scale;
+        glm::ivec3 size = glm::ivec3(0);
+        std::vector<int8_t> cells;
+
+        int index(int x, int y, int z) const {
+            return (x * size.y + y) * size.z + z;
+        }
+        // Recomputes the cells in [writeLo, writeHi) from the occupancy of the box [lo, lo + extent),
+        // which covers them and every cell within maxDistance.
+        void compute(const std::vector<uint8_t> &solid, glm::ivec3 lo, glm::ivec3 extent, glm::ivec3 writeLo, glm::ivec3 writeHi);
+        template <class Map>
+        void computeRegion(const Map &map, glm::ivec3 writeLo, glm::ivec3 writeHi);
+};
+
+
+template <class Map>
+void DistanceField::build(const Map &map) {
+    size = glm::ivec3(map.getXSize(), map.getYSize(), map.getZSize());
+    cells.assign(size.x * size.y * size.z, 0);
+    computeRegion(map, glm::ivec3(0), size);
+}
+
+
+template <class Map>
+void DistanceField::update(const Map &map, glm::ivec3 lo, glm::ivec3 hi) {
+    if (size != glm::ivec3(map.getXSize(), map.getYSize(), map.getZSize())) {
+        build(map);
+        return;
+    }
+    // Cells farther than maxDistance from the changes keep their clamped distance.
+    const int margin = (int)maxDistance + 1;
+    computeRegion(map, glm::max(lo - margin, glm::ivec3(0)), glm::min(hi + margin, size));
+}
+
+
+template <class Map>
+void DistanceField::computeRegion(const Map &map, glm::ivec3 writeLo, glm::ivec3 writeHi) {
+    if (glm::any(glm::greaterThanEqual(writeLo, writeHi))) {
+        return;
+    }
+    // The occupancy around the written cells, with one cell of the empty outside where the box
+    // reaches the border of the map.
+    const int margin = (int)maxDistance + 1;
+    const glm::ivec3 lo = glm::max(writeLo - margin, glm::ivec3(-1));
+    const glm::ivec3 hi = glm::min(writeHi + margin, size + 1);
+    const glm::ivec3 extent = hi - lo;
+    std::vector<uint8_t> solid(extent.x * extent.y * extent.z, 0);
+    ThreadPool::shared().parallelFor(extent.x, [&](int i) {
+        const int x = lo.x + i;
+        if (x < 0 || x >= size.x) return;
+        for (int y = std::max(lo.y, 0); y < std::min(hi.y, size.y); y++) {
+            const int row = (i * extent.y + (y - lo.y)) * extent.z;
+            for (int z = std::max(lo.z, 0); z < std::min(hi.z, size.z); z++) {
+                solid[row + (z - lo.z)] = map.getUnchecked(x, y, z) != 0;
+            }
+        }
+    });
+    compute(solid, lo, extent, writeLo, writeHi);
+}
+
+
+#endif // DISTANCEFIELD_H
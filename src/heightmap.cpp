@@ -0,0 +1,45 @@
+
+#include "heightmap.h"
+
+
+ColumnHeightmap::ColumnHeightmap(glm::ivec3 size) : size(glm::max(size, glm::ivec3(0))) {
+    heights.assign(this->size.x * this->size.y, 0);
+}
+
+
+void ColumnHeightmap::insertCell(std::vector<Span> &spans, int z) {
+    // First run which ends at or above z.
+    auto next = std::find_if(spans.begin(), spans.end(), [&](const Span &s) {return s.top >= z;});
+    if (next != spans.end() && next->top == z) {
+        // Extend the run below, and join it with the one above if the gap closes.
+        next->top++;
+        auto above = next + 1;
+        if (above != spans.end() && above->bottom == next->top) {
+            next->top = above->top;
+            spans.erase(above);
+        }
+    } else if (next != spans.end() && next->bottom == z + 1) {
+        next->bottom--;
+    } else if (next == spans.end() || next->bottom > z) {
+        spans.insert(next, {z, z + 1});
+    }
+}
+
+
+void ColumnHeightmap::removeCell(std::vector<Span> &spans, int z) {
+    auto span = std::find_if(spans.begin(), spans.end(), [&](const Span &s) {return s.top > z;});
+    if (span == spans.end() || span->bottom > z) {
+        return;
+    }
+    if (span->bottom == z && span->top == z + 1) {
+        spans.erase(span);
+    } else if (span->bottom == z) {
+        span->bottom++;
+    } else if (span->top == z + 1) {
+        span->top--;
+    } else {
+        const Span upper = {z + 1, span->top};
+        span->top = z;
+        spans.insert(span + 1, upper);
+    }
+}
@@ -0,0 +1,188 @@
+#ifndef HEIGHTMAP_H
+#define HEIGHTMAP_H
+
+#include <glm/vec3.hpp> // glm::ivec3
+#include <glm/common.hpp> // glm::min, glm::max
+#include <glm/vector_relational.hpp> // glm::any, glm::greaterThanEqual
+
+#include <algorithm>
+#include <vector>
+
+
+// Surface height of every (x, y) column of a voxel volume, z pointing up. With layers, all runs of
+// non-empty cells of every column are kept as well, for overhangs, bridges and caves. Changes of
+// single cells update the column in O(1) typically; only removing the top cell without layers has
+// to search the column downwards.
+class ColumnHeightmap {
+    public:
+        // Non-empty cells [bottom, top) of a column.
+        struct Span {
+            int bottom, top;
+        };
+
+        // All cells are empty.
+        ColumnHeightmap(glm::ivec3 size = glm::ivec3(0));
+
+        // Height of the top non-empty cell plus one, 0 if the column is empty.
+        int surfaceHeight(int x, int y) const {return heights[column(x, y)];}
+        // Top of the highest non-empty cell below z plus one, i.e. the ground under a point at height z.
+        // 0 if there is none. bool isSolid(glm::ivec3) is only used without layers.
+        template <class F>
+        int groundHeight(int x, int y, int z, F isSolid) const;
+
+        bool hasLayers() const {return !layers.empty();}
+        // Builds the layers from bool isSolid(glm::ivec3), or drops them.
+        template <class F>
+        void setLayers(bool enabled, F isSolid);
+        // Runs of non-empty cells from bottom to top. Requires layers.
+        const std::vector<Span>& getLayers(int x, int y) const {return layers[column(x, y)];}
+
+        // Must be called whenever a cell changes between empty and non-empty. isSolid reads the cells
+        // after the change.
+        template <class F>
+        void setSolid(glm::ivec3 p, bool solid, F isSolid);
+        // Updates the columns through [lo, hi) after cells in the box were changed without setSolid.
+        template <class F>
+        void refresh(glm::ivec3 lo, glm::ivec3 hi, F isSolid);
+
+    private:
+        glm::ivec3 size;
+        std::vector<int> heights;
+        // Per column if enabled, empty otherwise.
+        std::vector<std::vector<Span>> layers;
+
+        int column(int x, int y) const {
+            return x * size.y + y;
+        }
+        // Adds or removes cell z from the runs of a column.
+        static void insertCell(std::vector<Span> &spans, int z);
+        static void removeCell(std::vector<Span> &spans, int z);
+        // Replaces the runs of a column which touch the cells [lo, hi) by scanning them again.
+        template <class F>
+        void rescanLayers(int x, int y, int lo, int hi, F &isSolid);
+        // Highest non-empty cell in [lo, hi) plus one, 0 if there is none.
+        template <class F>
+        static int findTop(int x, int y, int lo, int hi, F &isSolid);
+};
+
+
+template <class F>
+int ColumnHeightmap::groundHeight(int x, int y, int z, F isSolid) const {
+    if (hasLayers()) {
+        const std::vector<Span> &spans = getLayers(x, y);
+        for (auto span = spans.rbegin(); span != spans.rend(); ++span) {
+            if (span->bottom < z) {
+                return std::min(span->top, z);
+            }
+        }
+        return 0;
+    }
+    return findTop(x, y, 0, std::min(z, surfaceHeight(x, y)), isSolid);
+}
+
+
+template <class F>
+void ColumnHeightmap::setLayers(bool enabled, F isSolid) {
+    if (enabled == hasLayers()) {
+        return;
+    }
+    if (!enabled) {
+        std::vector<std::vector<Span>>().swap(layers);
+        return;
+    }
+    layers.resize(size.x * size.y);
+    for (int x = 0; x < size.x; x++) {
+        for (int y = 0; y < size.y; y++) {
+            rescanLayers(x, y, 0, size.z, isSolid);
+        }
+    }
+}
+
+
+template <class F>
+void ColumnHeightmap::setSolid(glm::ivec3 p, bool solid, F isSolid) {
+    int &height = heights[column(p.x, p.y)];
+    if (hasLayers()) {
+        std::vector<Span> &spans = layers[column(p.x, p.y)];
+        if (solid) {
+            insertCell(spans, p.z);
+        } else {
+            removeCell(spans, p.z);
+        }
+        height = spans.empty() ? 0 : spans.back().top;
+    } else if (solid) {
+        height = std::max(height, p.z + 1);
+    } else if (p.z + 1 == height) {
+        height = findTop(p.x, p.y, 0, p.z, isSolid);
+    }
+}
+
+
+template <class F>
+void ColumnHeightmap::refresh(glm::ivec3 lo, glm::ivec3 hi, F isSolid) {
+    lo = glm::max(lo, glm::ivec3(0));
+    hi = glm::min(hi, size);
+    if (glm::any(glm::greaterThanEqual(lo, hi))) {
+        return;
+    }
+    for (int x = lo.x; x < hi.x; x++) {
+        for (int y = lo.y; y < hi.y; y++) {
+            int &height = heights[column(x, y)];
+            if (hasLayers()) {
+                rescanLayers(x, y, lo.z, hi.z, isSolid);
+                const std::vector<Span> &spans = layers[column(x, y)];
+                height = spans.empty() ? 0 : spans.back().top;
+            } else if (height <= hi.z) {
+                // The cells below the box did not change.
+                const int top = findTop(x, y, lo.z, hi.z, isSolid);
+                if (top > 0) {
+                    height = top;
+                } else if (height > lo.z) {
+                    height = findTop(x, y, 0, lo.z, isSolid);
+                }
+            }
+        }
+    }
+}
+
+
+template <class F>
+void ColumnHeightmap::rescanLayers(int x, int y, int lo, int hi, F &isSolid) {
+    // Runs which overlap or touch the range are scanned again as a whole.
+    std::vector<Span> &spans = layers[column(x, y)];
+    auto first = std::find_if(spans.begin(), spans.end(), [&](const Span &s) {return s.top >= lo;});
+    auto last = std::find_if(first, spans.end(), [&](const Span &s) {return s.bottom > hi;});
+    if (first != last) {
+        lo = std::min(lo, first->bottom);
+        hi = std::max(hi, (last - 1)->top);
+    }
+    std::vector<Span> scanned;
+    int bottom = -1;
+    for (int z = lo; z < hi; z++) {
+        const bool solid = isSolid(glm::ivec3(x, y, z));
+        if (solid && bottom < 0) {
+            bottom = z;
+        } else if (!solid && bottom >= 0) {
+            scanned.push_back({bottom, z});
+            bottom = -1;
+        }
+    }
+    if (bottom >= 0) {
+        scanned.push_back({bottom, hi});
+    }
+    spans.insert(spans.erase(first, last), scanned.begin(), scanned.end());
+}
+
+
+template <class F>
+int ColumnHeightmap::findTop(int x, int y, int lo, int hi, F &isSolid) {
+    for (int z = hi - 1; z >= lo; z--) {
+        if (isSolid(glm::ivec3(x, y, z))) {
+            return z + 1;
+        }
+    }
+    return 0;
+}
+
+
+#endif // HEIGHTMAP_H
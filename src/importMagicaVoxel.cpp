@@ -1,6 +1,12 @@
 
 #include "importMagicaVoxel.h"
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
 #include <stdexcept>
+#include <glm/matrix.hpp> // glm::determinant
+#include <glm/gtc/quaternion.hpp> // glm::quat_cast
 #include "utils.h"
 
 
@@ -26,28 +32,175 @@ glm::vec4 MV::rgbaToColorVec4(MV::RGBA rgba) {
 
 
 
-void MV::ModelLoader::ReadChunk( std::ifstream &file, chunk_t &chunk ) {
-    // read chunk
-    file.read((char*) &chunk.id, sizeof(int));
-    file.read((char*) &chunk.contentSize, sizeof(int));
-    file.read((char*) &chunk.childrenSize, sizeof(int));
+// Reads a little-endian int at pos.
+static int readInt( const uint8_t *pos ) {
+    int value;
+    std::memcpy(&value, pos, sizeof(int));
+    return value;
+}
+
+
+bool MV::ModelLoader::ReadChunk( const uint8_t *pos, const uint8_t *end, chunk_t &chunk ) {
+    // read chunk header
+    if ( end - pos < 3 * (ptrdiff_t)sizeof(int) ) {
+        return false;
+    }
+    chunk.id = readInt(pos);
+    chunk.contentSize = readInt(pos + 4);
+    chunk.childrenSize = readInt(pos + 8);
+    chunk.content = pos + 3 * sizeof(int);
 
-    int pos = file.tellg();
-    
     // end of chunk : used for skipping the whole chunk
-    chunk.end = pos + chunk.contentSize + chunk.childrenSize;
-    
-    // print chunk info
-    // const char *c = ( const char * )( &chunk.id );
-    // printf( "[Log] VoxelModelLoader :: Chunk : %c%c%c%c : %d %d\n",
-    //        c[0], c[1], c[2], c[3],
-    //        chunk.contentSize, chunk.childrenSize
-    //        );
+    if ( chunk.contentSize < 0 || chunk.childrenSize < 0
+        || end - chunk.content < (long long)chunk.contentSize + chunk.childrenSize ) {
+        return false;
+    }
+    chunk.end = chunk.content + chunk.contentSize + chunk.childrenSize;
+    return true;
 }
 
 
 
-bool MV::ModelLoader::ReadModelLoaderFile( std::ifstream &file ) {
+bool MV::ModelLoader::ReadDict( const uint8_t *&pos, const uint8_t *end, dict_t &dict ) {
+    if ( end - pos < (ptrdiff_t)sizeof(int) ) {
+        return false;
+    }
+    int count = readInt(pos);
+    pos += sizeof(int);
+    for ( int i = 0; i < count; i++ ) {
+        std::string pair[2];
+        for ( std::string &s : pair ) {
+            if ( end - pos < (ptrdiff_t)sizeof(int) ) {
+                return false;
+            }
+            int length = readInt(pos);
+            pos += sizeof(int);
+            if ( length < 0 || end - pos < length ) {
+                return false;
+            }
+            s.assign((const char*) pos, length);
+            pos += length;
+        }
+        dict[pair[0]] = pair[1];
+    }
+    return true;
+}
+
+
+// Rotation of the _r attribute of a transform node. Bits 0-1 and 2-3 give the column of the non-zero
+// entry in the first and second row, the third row takes the remaining one. Bits 4, 5 and 6 make the
+// entries of the rows negative.
+static glm::mat3 decodeRotation( int bits ) {
+    int columns[3] = { bits & 3, ( bits >> 2 ) & 3, 0 };
+    columns[2] = 3 - columns[0] - columns[1];
+    if ( columns[0] > 2 || columns[1] > 2 || columns[0] == columns[1] ) {
+        return glm::mat3(1.0f);
+    }
+    glm::mat3 rotation(0.0f);
+    for ( int row = 0; row < 3; row++ ) {
+        rotation[columns[row]][row] = ( bits >> ( 4 + row ) ) & 1 ? -1.0f : 1.0f;
+    }
+    return rotation;
+}
+
+
+bool MV::ModelLoader::ReadNode( const chunk_t &chunk ) {
+    const uint8_t *pos = chunk.content;
+    const uint8_t *end = chunk.content + chunk.contentSize;
+    // Reads the next int of the chunk into value.
+    auto next = [&]( int &value ) {
+        if ( end - pos < (ptrdiff_t)sizeof(int) ) {
+            return false;
+        }
+        value = readInt(pos);
+        pos += sizeof(int);
+        return true;
+    };
+
+    int nodeId;
+    dict_t attributes;
+    if ( !next( nodeId ) || !ReadDict( pos, end, attributes ) ) {
+        return false;
+    }
+    node_t node;
+    node.hidden = attributes["_hidden"] == "1";
+
+    int count;
+    if ( chunk.id == id( 'n', 'T', 'R', 'N' ) ) {
+        int child, reserved, layer;
+        if ( !next( child ) || !next( reserved ) || !next( layer ) || !next( count ) ) {
+            return false;
+        }
+        node.children.push_back(child);
+        // Only the first frame, animations are not supported.
+        dict_t frame;
+        if ( count > 0 && !ReadDict( pos, end, frame ) ) {
+            return false;
+        }
+        if ( !frame["_r"].empty() ) {
+            node.rotation = decodeRotation( std::atoi( frame["_r"].c_str() ) );
+        }
+        std::istringstream translation( frame["_t"] );
+        translation >> node.translation.x >> node.translation.y >> node.translation.z;
+    }
+    else if ( chunk.id == id( 'n', 'G', 'R', 'P' ) ) {
+        if ( !next( count ) ) {
+            return false;
+        }
+        for ( int i = 0; i < count; i++ ) {
+            int child;
+            if ( !next( child ) ) {
+                return false;
+            }
+            node.children.push_back(child);
+        }
+    }
+    else {
+        // Shapes list one model per frame, only the first is used.
+        if ( !next( count ) || ( count > 0 && !next( node.model ) ) ) {
+            return false;
+        }
+    }
+    nodes[nodeId] = node;
+    return true;
+}
+
+
+void MV::ModelLoader::AddInstances( int id, const glm::mat3 &rotation, glm::vec3 translation, int depth ) {
+    auto it = nodes.find(id);
+    // The depth limit stops cycles of broken files.
+    if ( it == nodes.end() || it->second.hidden || depth > (int)nodes.size() ) {
+        return;
+    }
+    const node_t &node = it->second;
+    if ( node.model >= 0 ) {
+        if ( node.model >= (int)models.size() ) {
+            return;
+        }
+        // The file puts voxel v at rotation * (v - size / 2) + translation, rounding size / 2 down,
+        // the mesh is centered on size / 2 without rounding.
+        const Model &model = models[node.model];
+        const glm::ivec3 size( model.sizex, model.sizey, model.sizez );
+        const glm::vec3 shift = glm::vec3(size) * 0.5f - glm::vec3(size / 2);
+        glm::mat3 proper = rotation;
+        if ( glm::determinant( proper ) < 0.0f ) {
+            proper[0] = -proper[0];
+        }
+        Instance instance;
+        instance.model = node.model;
+        instance.transform = Transform( translation + rotation * shift, glm::quat_cast( proper ) );
+        instances.push_back(instance);
+        return;
+    }
+    const glm::mat3 childRotation = rotation * node.rotation;
+    const glm::vec3 childTranslation = translation + rotation * glm::vec3(node.translation);
+    for ( int child : node.children ) {
+        AddInstances( child, childRotation, childTranslation, depth + 1 );
+    }
+}
+
+
+bool MV::ModelLoader::ReadModelLoaderFile( const uint8_t *data, size_t size ) {
     const int MV_VERSION = 150;
     
     const int ID_VOX  = id( 'V', 'O', 'X', ' ' );
@@ -55,80 +208,104 @@ bool MV::ModelLoader::ReadModelLoaderFile( std::ifstream &file ) {
     const int ID_SIZE = id( 'S', 'I', 'Z', 'E' );
     const int ID_XYZI = id( 'X', 'Y', 'Z', 'I' );
     const int ID_RGBA = id( 'R', 'G', 'B', 'A' );
+    const int ID_NTRN = id( 'n', 'T', 'R', 'N' );
+    const int ID_NGRP = id( 'n', 'G', 'R', 'P' );
+    const int ID_NSHP = id( 'n', 'S', 'H', 'P' );
     //const int ID_PACK = id( 'P', 'A', 'C', 'K' );
     
-    // magic number
-    int magic;
-    file.read((char*) &magic, sizeof(int)); 
-    //file >> magic;
-    if ( magic != ID_VOX ) {
+    // magic number and version
+    if ( size < 2 * sizeof(int) || readInt(data) != ID_VOX ) {
         Error( "magic number does not match" );
         return false;
     }
-    
-    // version
-    int version;
-    file.read((char*) &version, sizeof(int));
+    version = readInt(data + 4);
     if ( version != MV_VERSION ) {
         Error( "version does not match" );
         return false;
     }
     
     // main chunk
+    const uint8_t *fileEnd = data + size;
     chunk_t mainChunk;
-    ReadChunk( file, mainChunk );
-    if ( mainChunk.id != ID_MAIN ) {
+    if ( !ReadChunk( data + 2 * sizeof(int), fileEnd, mainChunk ) || mainChunk.id != ID_MAIN ) {
         Error( "main chunk is not found" );
         return false;
     }
     
     // skip content of main chunk
-    file.seekg(mainChunk.contentSize, std::ios_base::cur);
+    const uint8_t *pos = mainChunk.content + mainChunk.contentSize;
     
     Model currentModel;
     // read children chunks
-    while (file.tellg() < mainChunk.end) {
+    while (pos < mainChunk.end) {
         // read chunk header
         chunk_t sub;
-        ReadChunk( file, sub );
+        if ( !ReadChunk( pos, mainChunk.end, sub ) ) {
+            Error( "chunk exceeds the file" );
+            return false;
+        }
         
         if ( sub.id == ID_SIZE ) {
+            if ( sub.contentSize < 3 * (int)sizeof(int) ) {
+                Error( "size chunk is too short" );
+                return false;
+            }
             currentModel = Model();
             // size
-            file.read((char*) &currentModel.sizex, sizeof(int));
-            file.read((char*) &currentModel.sizey, sizeof(int));
-            file.read((char*) &currentModel.sizez, sizeof(int));
+            currentModel.sizex = readInt(sub.content);
+            currentModel.sizey = readInt(sub.content + 4);
+            currentModel.sizez = readInt(sub.content + 8);
         }
         else if ( sub.id == ID_XYZI ) {
             // numVoxels
-            file.read((char*) &currentModel.numVoxels, sizeof(int));
+            currentModel.numVoxels = sub.contentSize >= (int)sizeof(int) ? readInt(sub.content) : -1;
 
             if ( currentModel.numVoxels < 0 ) {
                 Error( "negative number of voxels" );
                 return false;
             }
-            
-            // voxels
-            if ( currentModel.numVoxels > 0 ) {
-                currentModel.voxels = new Voxel[ currentModel.numVoxels ];
-                file.read((char*) currentModel.voxels, currentModel.numVoxels * sizeof(int));
+            if ( currentModel.numVoxels > (sub.contentSize - (int)sizeof(int)) / (int)sizeof(Voxel) ) {
+                Error( "voxels exceed the chunk" );
+                return false;
             }
+            
+            // voxels, Voxel is four bytes without alignment requirements
+            currentModel.voxels = (const Voxel*) (sub.content + sizeof(int));
 
             models.push_back(currentModel);
         }
         else if ( sub.id == ID_RGBA ) {
+            if ( sub.contentSize < (int)sizeof(RGBA) * 256 ) {
+                Error( "palette chunk is too short" );
+                return false;
+            }
             // last color is not used, so we only need to read 255 colors
-            isCustomPalette = true;
-            file.read((char*) palette + 1, sizeof(RGBA) * 255);
-
             // NOTICE : skip the last reserved color
-            RGBA reserved;
-            file.read((char*) &reserved, sizeof(RGBA));
+            // The file stores r, g, b, a; one byte into the a, r, g, b entries, palette[i] holds the
+            // r, g, b of color i.
+            isCustomPalette = true;
+            std::memcpy((uint8_t*) palette + 1, sub.content, sizeof(RGBA) * 255);
+        }
+        else if ( sub.id == ID_NTRN || sub.id == ID_NGRP || sub.id == ID_NSHP ) {
+            if ( !ReadNode( sub ) ) {
+                Error( "scene graph node exceeds its chunk" );
+                return false;
+            }
         }
 
         // skip unread bytes of current chunk or the whole unused chunk
-        file.seekg(sub.end, std::ios::beg);
+        pos = sub.end;
+    }
+
+    // The root of the scene graph is transform node 0.
+    if ( nodes.count(0) ) {
+        AddInstances( 0, glm::mat3(1.0f), glm::vec3(0.0f), 0 );
+    } else {
+        for ( int i = 0; i < (int)models.size(); i++ ) {
+            instances.push_back({i, Transform()});
+        }
     }
+    nodes.clear();
     
     // print ModelLoader info
     // printf( "[Log] VoxelModelLoader :: ModelLoader : %d %d %d : %d\n",
@@ -140,7 +317,7 @@ bool MV::ModelLoader::ReadModelLoaderFile( std::ifstream &file ) {
 
 
 
-TileMap3d* MV::makeTileMapSingle(const MV::Model &model, bool isCustomPalette, const MV::RGBA* palette, bool makeMesh) {
+Palette MV::makePalette(bool isCustomPalette, const MV::RGBA* palette) {
     std::vector<Tile> pal;
     Tile t;
     t.color = glm::vec4(0.0, 0.0, 0.0, 1.0);
@@ -156,13 +333,20 @@ TileMap3d* MV::makeTileMapSingle(const MV::Model &model, bool isCustomPalette, c
 			pal.push_back(tile);
 		}
 	}
+    return pal;
+}
 
-	TileMap3d* tilemap = new TileMap3d(pal, model.sizex, model.sizey, model.sizez);
 
-	for (int i = 0; i < model.numVoxels; i++) {
-		MV::Voxel v = model.voxels[i];
-		tilemap->set(v.x, v.y, v.z, v.colorIndex);
-	}
+TileMap3d* MV::makeTileMapSingle(const MV::Model &model, bool isCustomPalette, const MV::RGBA* palette, bool makeMesh) {
+    return MV::makeTileMapSingle(model, SharedPalette(MV::makePalette(isCustomPalette, palette)), makeMesh);
+}
+
+
+TileMap3d* MV::makeTileMapSingle(const MV::Model &model, SharedPalette palette, bool makeMesh) {
+	TileMap3d* tilemap = new TileMap3d(palette, model.sizex, model.sizey, model.sizez, CellStorage::narrowestType(palette->size()));
+
+	// Byte color indices always fit the 256 entry palette, the XYZI records are written in one pass.
+	tilemap->importVoxels(model.voxels, model.numVoxels);
     if (makeMesh) {
         tilemap->updateMesh();
     }
@@ -171,20 +355,49 @@ TileMap3d* MV::makeTileMapSingle(const MV::Model &model, bool isCustomPalette, c
 
 
 
-std::vector<TileMap3d*> MV::makeTileMapsFromFile(const char* path, bool makeMeshes, bool &success) {
+std::vector<TileMap3d*> MV::makeTileMapsFromFile(const char* path, bool makeMeshes, bool &success, std::vector<Instance>* instances) {
     MV::ModelLoader modelLoader;
     success = modelLoader.loadModel(path);
     if (!success) {
         throw std::runtime_error("File broken!");
     }
-    std::vector<MV::Model> models = modelLoader.models;
     std::vector<TileMap3d*> tilemaps;
-    for (unsigned int i = 0; i < models.size(); i++) {
-        MV::Model model = models[i];
-        TileMap3d* tm = MV::makeTileMapSingle(model, modelLoader.isCustomPalette, modelLoader.palette, makeMeshes);
+    SharedPalette palette(MV::makePalette(modelLoader.isCustomPalette, modelLoader.palette));
+    for (const MV::Model &model : modelLoader.models) {
+        TileMap3d* tm = MV::makeTileMapSingle(model, palette, makeMeshes);
         tilemaps.push_back(tm);
     }
+    if (instances != nullptr) {
+        *instances = modelLoader.instances;
+    }
 
     modelLoader.free();
     return tilemaps;
 }
+
+
+OctreeTileMap3d* MV::makeOctreeTileMapSingle(const MV::Model &model, bool isCustomPalette, const MV::RGBA* palette, bool makeMesh) {
+    OctreeTileMap3d* tilemap = new OctreeTileMap3d(MV::makePalette(isCustomPalette, palette), model.sizex, model.sizey, model.sizez);
+    for (int i = 0; i < model.numVoxels; i++) {
+        MV::Voxel v = model.voxels[i];
+        tilemap->set(v.x, v.y, v.z, v.colorIndex);
+    }
+    if (makeMesh) {
+        tilemap->updateMesh();
+    }
+    return tilemap;
+}
+
+
+std::vector<OctreeTileMap3d*> MV::makeOctreeTileMapsFromFile(const char* path, bool makeMeshes, bool &success) {
+    MV::ModelLoader modelLoader;
+    success = modelLoader.loadModel(path);
+    if (!success) {
+        throw std::runtime_error("File broken!");
+    }
+    std::vector<OctreeTileMap3d*> tilemaps;
+    for (const MV::Model &model : modelLoader.models) {
+        tilemaps.push_back(MV::makeOctreeTileMapSingle(model, modelLoader.isCustomPalette, modelLoader.palette, makeMeshes));
+    }
+    return tilemaps;
+}
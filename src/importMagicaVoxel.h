@@ -3,9 +3,18 @@
 #define MV_H
 
 #include "stdio.h"
-#include <fstream>
+#include <stdint.h>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <glm/mat3x3.hpp>
 
 #include "tilemap3d.h"
+#include "octreetilemap3d.h"
+#include "mappedfile.h"
+#include "transform.h"
 
 namespace MV {
 
@@ -33,6 +42,7 @@ glm::vec4 rgbaToColorVec4(MV::RGBA rgba);
 struct Voxel {
     unsigned char x, y, z, colorIndex;
 };
+static_assert(sizeof(Voxel) == 4, "Voxel must match the XYZI records");
 
 
 const unsigned int default_palette[256] = {
@@ -55,13 +65,23 @@ const unsigned int default_palette[256] = {
 };
 
 
+// Placement of a model by a shape node of the scene graph.
+struct Instance {
+    // Index into ModelLoader::models.
+    int model;
+    // Of the mesh of the model made by makeTileMapSingle, which is centered on the model, in the
+    // coordinates of the file. Reflections of the file cannot be expressed and are dropped.
+    Transform transform;
+};
+
+
 struct Model {
     // size
     int sizex, sizey, sizez;
     
-    // voxels
+    // voxels, pointing into the file mapped by the ModelLoader. Valid until it is freed.
     int numVoxels = 0;
-    Voxel *voxels;
+    const Voxel *voxels = nullptr;
 
 };
 
@@ -69,13 +89,18 @@ struct Model {
 //================
 // ModelLoader
 //================
+// Reads the chunks of a .vox file in place from a memory mapping of the file. Models are views of
+// their XYZI chunks, voxels are neither allocated nor copied.
 class ModelLoader {
 public :
     std::vector<Model> models;
+    // One per shape node reached from the root of the scene graph, models placed several times share
+    // their index. Files without a scene graph place every model once at the origin.
+    std::vector<Instance> instances;
 
     // palette
     bool isCustomPalette = false;
-    RGBA palette[ 256 ];
+    RGBA palette[ 256 ] = {};
 
     // version
     int version;
@@ -86,10 +111,10 @@ public :
     }
 
     void free() {
-        for(std::vector<Model>::iterator it = models.begin(); it != models.end(); ++it) { 
-            delete[] it->voxels;
-        }
         models = std::vector<Model>();
+        instances = std::vector<Instance>();
+        nodes = std::map<int, node_t>();
+        file.close();
     }
 
     
@@ -99,17 +124,13 @@ public :
         // free old data
         free();
 
-        // open file
-        std::ifstream file;
-        file.open(path, std::ios::in | std::ios::binary);
-        if (!file.is_open()) {
-            Error( (std::string("failed to open file") + path).c_str() );
+        // map file
+        if (!file.open(path)) {
+            Error( (std::string("failed to open file ") + path).c_str() );
             return false;
-        }        
+        }
         // read file
-        bool success = ReadModelLoaderFile( file );
-        
-        file.close();
+        bool success = ReadModelLoaderFile( file.data(), file.size() );
         
         // if failed, free invalid data
         if ( !success ) {
@@ -124,12 +145,35 @@ private :
         int id;
         int contentSize;
         int childrenSize;
-        long end;
+        // content starts here
+        const uint8_t *content;
+        const uint8_t *end;
+    };
+
+    // Node of the scene graph: nTRN with one child, nGRP with any number, nSHP with a model.
+    struct node_t {
+        bool hidden = false;
+        std::vector<int> children;
+        int model = -1;
+        // Of nTRN, from the first frame.
+        glm::ivec3 translation = glm::ivec3(0);
+        glm::mat3 rotation = glm::mat3(1.0f);
     };
+    typedef std::map<std::string, std::string> dict_t;
+
+    MappedFile file;
+    std::map<int, node_t> nodes;
     
 private :
-    bool ReadModelLoaderFile( std::ifstream &file );    
-    void ReadChunk( std::ifstream &file, chunk_t &chunk );
+    bool ReadModelLoaderFile( const uint8_t *data, size_t size );
+    // False if the chunk does not fit into [pos, end).
+    bool ReadChunk( const uint8_t *pos, const uint8_t *end, chunk_t &chunk );
+    // Reads a node chunk into nodes. False if it exceeds the chunk.
+    bool ReadNode( const chunk_t &chunk );
+    // Advances pos past the dictionary. False if it exceeds end.
+    bool ReadDict( const uint8_t *&pos, const uint8_t *end, dict_t &dict );
+    // Adds the instances below node id. rotation and translation are the transform of its parent.
+    void AddInstances( int id, const glm::mat3 &rotation, glm::vec3 translation, int depth );
         
     void Error( const char *info ) const {
         std::cout << "[Error] VoxelModelLoader :: " << info << "\n";
@@ -137,9 +181,20 @@ private :
 };
 
 
-std::vector<TileMap3d*> makeTileMapsFromFile(const char* path, bool makeMeshes, bool &success);
+// One tilemap per model of the file. Instances of the scene graph are added to instances if given,
+// their model indices index the tilemaps.
+std::vector<TileMap3d*> makeTileMapsFromFile(const char* path, bool makeMeshes, bool &success, std::vector<Instance>* instances = nullptr);
 
 TileMap3d* makeTileMapSingle(const MV::Model &model, bool isCustomPalette, const MV::RGBA* palette, bool makeMesh);
+// Tilemap using the given palette, models of one file share it.
+TileMap3d* makeTileMapSingle(const MV::Model &model, SharedPalette palette, bool makeMesh);
+
+// Index 0 is the reserved empty tile, followed by the 255 colors of the file or the default palette.
+Palette makePalette(bool isCustomPalette, const MV::RGBA* palette);
+
+std::vector<OctreeTileMap3d*> makeOctreeTileMapsFromFile(const char* path, bool makeMeshes, bool &success);
+
+OctreeTileMap3d* makeOctreeTileMapSingle(const MV::Model &model, bool isCustomPalette, const MV::RGBA* palette, bool makeMesh);
 
 
 } // namespace MV
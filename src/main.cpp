@@ -23,6 +23,9 @@
 
 #include "mesh.h"
 #include "tilemap3d.h"
+#include "chunkedtilemap3d.h"
+#include "worldstreamer.h"
+#include "assetmanager.h"
 #include "importMagicaVoxel.h"
 #include "utils.h"
 #include "camera.h"
@@ -38,6 +41,7 @@
 #include "misccomponents.h"
 #include "entity.h"
 #include "utils.h"
+#include "benchmark.h"
 
 //Screen dimension constants
 // const int SCREEN_WIDTH = 640;
@@ -85,9 +89,22 @@ const char* g_pacmanTerrainFile = "data/model/pacman_walls2.vox";
 //Mesh gTetraMesh;
 TileMap3d* g_axisTileMap;
 TileMap3d* g_cubeTileMap;
-TileMap3d* g_teaPotTileMap;
+TileMap3d* g_teaPotTileMap = nullptr;
 std::vector<TileMap3d*> gCastleTiles;
+std::vector<Entity> gCastleEntities;
 std::vector<TileMap3d*> g_pacmanTiles;
+Entity g_teapotEntity;
+
+// Loads and meshes the models in the background. Meshes are kept in the cache directory between runs,
+// the cache is created by initScene.
+MeshCache* g_meshCache = nullptr;
+AssetManager g_assets;
+
+// Procedural terrain streamed around the camera, enabled with --stream.
+bool g_streamWorld = false;
+ChunkedTileMap3d* g_streamedMap = nullptr;
+WorldStreamer* g_streamer = nullptr;
+Entity g_streamedEntity;
 
 float gCameraA = 0;
 float gCameraB = 0;
@@ -219,7 +236,7 @@ bool init()
 	return true;
 }
 
-bool setupMap() {
+bool setupMap(VoxAsset &terrainAsset) {
 	for (int i = 0; i < full_width; i++) {
 		for (int j = 0; j < full_height; j++) {
 
@@ -250,12 +267,12 @@ bool setupMap() {
 		}
 	}
 
-	bool success;
-	std::vector<TileMap3d*> terrain_models = MV::makeTileMapsFromFile(g_pacmanTerrainFile, true, success);
-	if (!success) {
+	const std::vector<TileMap3d*> &terrain_models = terrainAsset.get();
+	if (terrainAsset.failed()) {
 		return false;
 	}
 
+	// Copies share voxels and mesh with the loaded models.
 	std::vector<TileMap3d> palette;
 	palette.push_back(*(terrain_models[0])); // Unused
 	palette.push_back(*(terrain_models[1])); // Straight
@@ -264,7 +281,7 @@ bool setupMap() {
 	palette.push_back(*(terrain_models[3])); // Ground
 
 	auto map_entity = g_world.create();
-	auto& terrain = g_world.assign<TileMap3dT<TileMap3d>>(map_entity, palette, full_width, full_height, 2);
+	auto& terrain = g_world.assign<TileMap3dT<TileMap3d>>(map_entity, palette, full_width, full_height, 2, CellType::PALETTE_PACKED);
 
 	terrain.tile_size = 6;
 	for (int x = 0; x < full_width; x++) {
@@ -330,31 +347,95 @@ bool setupMap() {
 }
 
 
-bool initScene() 
-{
-	bool success;
-
-	auto tileMaps = MV::makeTileMapsFromFile(g_teapotFile, true, success);
-	g_teaPotTileMap = tileMaps[0];
-	if (!success) {
-		return false;
+// Rolling hills with a layer of dirt and grass on stone, empty below z = 0.
+CellStorage generateTerrainChunk(glm::ivec3 key) {
+	const int size = ChunkedTileMap3d::CHUNK_SIZE;
+	CellStorage cells(CellType::UINT8, size * size * size);
+	if (key.z < 0) {
+		return cells;
 	}
+	for (int x = 0; x < size; x++) {
+		for (int y = 0; y < size; y++) {
+			float wx = key.x * size + x;
+			float wy = key.y * size + y;
+			int height = (int)(24 + 14 * std::sin(wx * 0.03f) * std::cos(wy * 0.025f) + 6 * std::sin((wx + wy) * 0.011f));
+			for (int z = 0; z < size; z++) {
+				int wz = key.z * size + z;
+				if (wz >= height) break;
+				unsigned int value = wz < height - 4 ? 1 : (wz < height - 1 ? 2 : 3);
+				cells.set(ChunkedTileMap3d::localIndex(x, y, z), value);
+			}
+		}
+	}
+	return cells;
+}
 
+void setupStreamedWorld() {
+	Palette palette = {
+		{glm::vec4()},
+		{glm::vec4(0.45, 0.45, 0.45, 1.0)}, // Stone
+		{glm::vec4(0.45, 0.3, 0.15, 1.0)}, // Dirt
+		{glm::vec4(0.2, 0.55, 0.15, 1.0)} // Grass
+	};
+	g_streamedMap = new ChunkedTileMap3d(palette);
+	g_streamedMap->packedVertices = true;
+	g_streamer = new WorldStreamer(*g_streamedMap, generateTerrainChunk);
 
-	gCastleTiles = MV::makeTileMapsFromFile(gCastleTileMapFile, true, success);
-	if (!success) {
-		return false;
+	g_streamedEntity = g_world.create();
+	g_world.assign<RenderComponent>(g_streamedEntity);
+	g_world.assign<Transform>(g_streamedEntity);
+}
+
+
+// One entity per instance of the scene graph of a .vox file, placed relative to root. Instances of
+// the same model share the mesh of its tilemap.
+std::vector<Entity> spawnVoxScene(const std::vector<TileMap3d*> &tileMaps, const std::vector<MV::Instance> &instances, Transform root) {
+	std::vector<Entity> entities;
+	for (const MV::Instance &instance : instances) {
+		Entity entity = g_world.create();
+		auto& renderComponent = g_world.assign<RenderComponent>(entity);
+		MeshRenderObject mesh;
+		mesh.meshID = tileMaps[instance.model]->meshID;
+		renderComponent.meshes.push_back(mesh);
+		g_world.assign<Transform>(entity, root * instance.transform);
+		entities.push_back(entity);
 	}
+	return entities;
+}
+
+
+bool initScene() 
+{
+	g_meshCache = new MeshCache("cache");
+	g_assets = AssetManager(g_meshCache);
+
+	// All files are loaded and meshed at once on the thread pool. Only the pacman walls are needed
+	// for the first frame, the other models are filled in by update when they are ready.
+	g_assets.loadVox(g_teapotFile, true, [](const std::vector<TileMap3d*> &tileMaps, const std::vector<MV::Instance>&) {
+		g_teaPotTileMap = tileMaps[0];
+		g_world.get<RenderComponent>(g_teapotEntity).meshes[0].meshID = g_teaPotTileMap->meshID;
+	});
+	g_assets.loadVox(gCastleTileMapFile, true, [](const std::vector<TileMap3d*> &tileMaps, const std::vector<MV::Instance> &instances) {
+		gCastleTiles = tileMaps;
+		// Next to the pacman map.
+		gCastleEntities = spawnVoxScene(tileMaps, instances, Transform(glm::vec3(-150, 0, 0)));
+	});
+	std::shared_ptr<VoxAsset> terrainAsset = g_assets.loadVox(g_pacmanTerrainFile, true);
 
-	auto teapot = g_world.create();
-	auto& renderComponent = g_world.assign<RenderComponent>(teapot);
+	g_teapotEntity = g_world.create();
+	auto& renderComponent = g_world.assign<RenderComponent>(g_teapotEntity);
 	MeshRenderObject mesh;
-	mesh.meshID = g_teaPotTileMap->meshID;
+	mesh.meshID = 0;
 	mesh.enabled = false;
 	renderComponent.meshes.emplace_back(mesh);
-	auto& tr = g_world.assign<Transform>(teapot);
+	auto& tr = g_world.assign<Transform>(g_teapotEntity);
 
-	setupMap();
+	if (!setupMap(*terrainAsset)) {
+		return false;
+	}
+	if (g_streamWorld) {
+		setupStreamedWorld();
+	}
 
 	gCamera.fov = glm::radians(45.f);
 	gCamera.near = 0.1f;
@@ -601,6 +682,11 @@ void update(float dt)
 		gCamera.eyePosition -= (screenRight * gCamera.rotation) * posStep;
 	}
 
+	g_assets.update();
+	if (g_streamer != nullptr) {
+		g_streamer->update(gCamera.eyePosition, gCamera.forwardVec());
+	}
+
     g_world.view<Transform, SimplePatrolBehavior>().each([dt](const auto, auto &transform, auto &patrol) {
 		updatePatrolBehavior(transform, patrol, dt);
     });
@@ -645,6 +731,10 @@ void renderFrame()
 		auto& renderable = renderTilemapView.template get< RenderComponent >(entity);
 		renderable.meshes = tilemap.getRenderables();
 	}
+	if (g_streamedMap != nullptr) {
+		// The streamer limits the remeshing per frame.
+		g_world.get<RenderComponent>(g_streamedEntity).meshes = g_streamedMap->getRenderables(false);
+	}
 
 	// Render Calls for meshes
 
@@ -723,6 +813,8 @@ void closeProgram()
 {
 	
 	//Deallocate program
+	delete g_streamer;
+	delete g_streamedMap;
 
 	//Destroy window
 	if (gWindow != 0)	
@@ -738,6 +830,12 @@ int main( int argc, char* args[] )
 {
 	setbuf(stdout, nullptr);
 
+	if (argc > 1 && std::string(args[1]) == "--benchmark") {
+		Benchmark::run(std::vector<std::string>(args + 2, args + argc));
+		return 0;
+	}
+	g_streamWorld = argc > 1 && std::string(args[1]) == "--stream";
+
 	if(!init())
 	{
 		printf( "Failed to initialize!\n" );
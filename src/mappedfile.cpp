@@ -0,0 +1,103 @@
+#include "mappedfile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string &path) {
+    close();
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize)) {
+        CloseHandle(file);
+        return false;
+    }
+    length = (size_t)fileSize.QuadPart;
+    if (length > 0) {
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping != nullptr) {
+            mapped = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        }
+        if (mapped == nullptr) {
+            if (mapping != nullptr) CloseHandle(mapping);
+            mapping = nullptr;
+            CloseHandle(file);
+            length = 0;
+            return false;
+        }
+    }
+    // The mapping keeps the file open.
+    CloseHandle(file);
+    opened = true;
+    return true;
+}
+
+
+void MappedFile::close() {
+    if (mapped != nullptr) {
+        UnmapViewOfFile(mapped);
+        CloseHandle(mapping);
+    }
+    mapped = nullptr;
+    mapping = nullptr;
+    length = 0;
+    opened = false;
+}
+
+#else
+
+bool MappedFile::open(const std::string &path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        ::close(fd);
+        return false;
+    }
+    length = (size_t)info.st_size;
+    if (length > 0) {
+        void* address = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        if (address == MAP_FAILED) {
+            ::close(fd);
+            length = 0;
+            return false;
+        }
+        mapped = (const uint8_t*)address;
+    }
+    // The mapping keeps the file open.
+    ::close(fd);
+    opened = true;
+    return true;
+}
+
+
+void MappedFile::close() {
+    if (mapped != nullptr) {
+        munmap((void*)mapped, length);
+    }
+    mapped = nullptr;
+    length = 0;
+    opened = false;
+}
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+
+// Read-only memory mapping of a whole file, with mmap or MapViewOfFile. The data stays valid until the
+// file is closed or opened again. Changes of the file size are only seen after opening it again.
+class MappedFile {
+    public:
+        MappedFile() {}
+        ~MappedFile();
+
+        MappedFile(const MappedFile &other) = delete;
+        MappedFile& operator=(const MappedFile &other) = delete;
+
+        // Returns false if the file cannot be opened or mapped.
+        bool open(const std::string &path);
+        void close();
+
+        bool isOpen() const {return opened;}
+        // Null for empty files.
+        const uint8_t* data() const {return mapped;}
+        size_t size() const {return length;}
+
+    private:
+        bool opened = false;
+        const uint8_t* mapped = nullptr;
+        size_t length = 0;
+#ifdef _WIN32
+        void* mapping = nullptr;
+#endif
+};
+
+
+#endif // MAPPEDFILE_H
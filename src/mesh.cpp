@@ -1,6 +1,9 @@
 
 #include "mesh.h"
 
+#include <algorithm>
+#include <iterator>
+
 std::map<Renderer::MeshID, std::shared_ptr<Renderer::Mesh>> Renderer::meshes;
 
 
@@ -9,6 +12,52 @@ void Renderer::Mesh::prepareDraw(ShaderProgram& shaderProgram) {
 
     glBindVertexArray(this->VAO);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
+
+    shaderProgram.setUniform("u_packedVertices", (GLint)packed);
+    if (packed) {
+        glBindBufferBase(GL_UNIFORM_BUFFER, PALETTE_BLOCK_BINDING, paletteUBO);
+    }
+}
+
+
+typedef std::vector<std::pair<unsigned int, unsigned int>> DirtyRanges;
+
+// Adds [begin, end) to the sorted disjoint ranges, merging it with the ones it overlaps or touches.
+static void addDirtyRange(DirtyRanges &ranges, unsigned int begin, unsigned int end)
+{
+    if (begin >= end) return;
+    auto it = std::lower_bound(ranges.begin(), ranges.end(), std::make_pair(begin, 0u));
+    if (it != ranges.begin() && std::prev(it)->second >= begin) {
+        --it;
+    }
+    auto last = it;
+    while (last != ranges.end() && last->first <= end) {
+        begin = std::min(begin, last->first);
+        end = std::max(end, last->second);
+        ++last;
+    }
+    it = ranges.erase(it, last);
+    ranges.insert(it, std::make_pair(begin, end));
+}
+
+
+// Uploads count elements of data to the buffer bound to target. If the buffer is large enough only the
+// dirty ranges are uploaded, otherwise it is reallocated with some headroom for further patches.
+static void uploadBuffer(GLenum target, const void* data, unsigned int count, unsigned int elementSize, 
+    unsigned int &capacity, const DirtyRanges &dirty)
+{
+    if (count <= capacity) {
+        for (const auto &range : dirty) {
+            unsigned int end = std::min(range.second, count);
+            if (range.first >= end) break;
+            glBufferSubData(target, range.first * elementSize, (end - range.first) * elementSize, 
+                (const char*)data + range.first * elementSize);
+        }
+    } else {
+        capacity = capacity == 0 ? count : count + count / 4;
+        glBufferData(target, capacity * elementSize, nullptr, GL_STATIC_DRAW);
+        glBufferSubData(target, 0, count * elementSize, data);
+    }
 }
 
 
@@ -21,20 +70,52 @@ void Renderer::Mesh::setup(ShaderProgram &shaderProgram)
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
         glGenBuffers(1, &EBO);
+
+        if (packed) {
+            glGenBuffers(1, &paletteUBO);
+            glBindBuffer(GL_UNIFORM_BUFFER, paletteUBO);
+            glBufferData(GL_UNIFORM_BUFFER, PACKED_PALETTE_SIZE * sizeof(glm::vec4), paletteColors.data(), GL_STATIC_DRAW);
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        }
     }
 
     glBindVertexArray(VAO);
     // load data into buffers
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);  
+    if (packed) {
+        uploadBuffer(GL_ARRAY_BUFFER, packedVertices.data(), packedVertices.size(), sizeof(PackedVertex), 
+            vertexCapacity, dirtyVertices);
+    } else {
+        uploadBuffer(GL_ARRAY_BUFFER, vertices.data(), vertices.size(), sizeof(Vertex), 
+            vertexCapacity, dirtyVertices);
+    }
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+    uploadBuffer(GL_ELEMENT_ARRAY_BUFFER, indices.data(), indices.size(), sizeof(unsigned int), 
+        indexCapacity, dirtyIndices);
+
+    dirtyVertices.clear();
+    dirtyIndices.clear();
 
     // set the vertex attribute pointers
     // vertex Positions
     GLuint positionAttribute = shaderProgram.attributeID("a_vertexPosition");
     glEnableVertexAttribArray(positionAttribute);	
+
+    if (packed) {
+        // half voxel units, scaled in the vertex shader
+        glVertexAttribPointer(positionAttribute, 3, GL_SHORT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, position));
+
+        // normal and palette index
+        GLuint packedAttribute = shaderProgram.attributeID("a_packedData");
+        glEnableVertexAttribArray(packedAttribute);
+        glVertexAttribIPointer(packedAttribute, 2, GL_UNSIGNED_BYTE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, normal));
+
+        glBindVertexArray(0);
+        needUpdate = false;
+        return;
+    }
+
     glVertexAttribPointer(positionAttribute, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
 
     // vertex normals
@@ -65,12 +146,87 @@ Renderer::MeshID Renderer::newMesh(std::vector<Vertex> &vertices, std::vector<un
     return i;
 }
 
+Renderer::MeshID Renderer::newMesh(std::vector<PackedVertex> &vertices, std::vector<unsigned int> &indices, std::vector<glm::vec4> &palette) {
+    unsigned int i = 1;
+    while (meshes.find(i) != meshes.end()) {
+        i++;
+    }
+
+    meshes[i] = std::make_shared<Mesh>(vertices, indices, palette);
+    meshes[i]->id = i;
+    return i;
+}
+
 void Renderer::updateMesh(MeshID id, std::vector<Vertex> &vertices, std::vector<unsigned int> &indices) {
     assert (meshes.find(id) != meshes.end());
     meshes[id] = std::make_shared<Mesh>(vertices, indices);
     meshes[id]->id = id;
 }
 
+void Renderer::updateMesh(MeshID id, std::vector<PackedVertex> &vertices, std::vector<unsigned int> &indices, std::vector<glm::vec4> &palette) {
+    assert (meshes.find(id) != meshes.end());
+    meshes[id] = std::make_shared<Mesh>(vertices, indices, palette);
+    meshes[id]->id = id;
+}
+
+Renderer::MeshID Renderer::newMesh(const Vertex* vertices, unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount) {
+    unsigned int i = 1;
+    while (meshes.find(i) != meshes.end()) {
+        i++;
+    }
+
+    meshes[i] = std::make_shared<Mesh>(vertices, vertexCount, indices, indexCount);
+    meshes[i]->id = i;
+    return i;
+}
+
+Renderer::MeshID Renderer::newMesh(const PackedVertex* vertices, unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount,
+    std::vector<glm::vec4> &palette)
+{
+    unsigned int i = 1;
+    while (meshes.find(i) != meshes.end()) {
+        i++;
+    }
+
+    meshes[i] = std::make_shared<Mesh>(vertices, vertexCount, indices, indexCount, palette);
+    meshes[i]->id = i;
+    return i;
+}
+
+void Renderer::updateMesh(MeshID id, const Vertex* vertices, unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount) {
+    assert (meshes.find(id) != meshes.end());
+    meshes[id] = std::make_shared<Mesh>(vertices, vertexCount, indices, indexCount);
+    meshes[id]->id = id;
+}
+
+void Renderer::updateMesh(MeshID id, const PackedVertex* vertices, unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount,
+    std::vector<glm::vec4> &palette)
+{
+    assert (meshes.find(id) != meshes.end());
+    meshes[id] = std::make_shared<Mesh>(vertices, vertexCount, indices, indexCount, palette);
+    meshes[id]->id = id;
+}
+
+void Renderer::patchMesh(MeshID id, unsigned int vertexStart, unsigned int vertexCount, std::vector<Vertex> &vertices,
+    unsigned int indexStart, unsigned int indexCount, std::vector<unsigned int> &indices) 
+{
+    assert (meshes.find(id) != meshes.end());
+    meshes[id]->patch(vertexStart, vertexCount, vertices, indexStart, indexCount, indices);
+}
+
+void Renderer::patchMesh(MeshID id, unsigned int vertexStart, unsigned int vertexCount, std::vector<PackedVertex> &vertices,
+    unsigned int indexStart, unsigned int indexCount, std::vector<unsigned int> &indices) 
+{
+    assert (meshes.find(id) != meshes.end());
+    meshes[id]->patch(vertexStart, vertexCount, vertices, indexStart, indexCount, indices);
+}
+
+void Renderer::spreadMesh(MeshID id, const std::vector<MeshSlot> &slots)
+{
+    assert (meshes.find(id) != meshes.end());
+    meshes[id]->spread(slots);
+}
+
 void Renderer::deleteMesh(Renderer::MeshID id) {
     meshes.erase(id);
 }
@@ -79,12 +235,141 @@ std::shared_ptr<Renderer::Mesh> Renderer::getMesh(unsigned int id) {
     return meshes[id];
 }
 
+void Renderer::Mesh::patch(unsigned int vertexStart, unsigned int vertexCount, const std::vector<Vertex> &newVertices,
+    unsigned int indexStart, unsigned int indexCount, const std::vector<unsigned int> &newIndices)
+{
+    assert(!packed);
+    patchVertices(vertices, vertexStart, vertexCount, newVertices);
+    patchIndices(vertexStart, (long)newVertices.size() - (long)vertexCount, indexStart, indexCount, newIndices);
+}
+
+void Renderer::Mesh::patch(unsigned int vertexStart, unsigned int vertexCount, const std::vector<PackedVertex> &newVertices,
+    unsigned int indexStart, unsigned int indexCount, const std::vector<unsigned int> &newIndices)
+{
+    assert(packed);
+    patchVertices(packedVertices, vertexStart, vertexCount, newVertices);
+    patchIndices(vertexStart, (long)newVertices.size() - (long)vertexCount, indexStart, indexCount, newIndices);
+}
+
+
+void Renderer::Mesh::spread(const std::vector<MeshSlot> &slots)
+{
+    if (packed) {
+        spreadVertices(packedVertices, slots, PackedVertex{});
+    } else {
+        spreadVertices(vertices, slots, Vertex{glm::vec3(0.0f), glm::vec3(0.0f), glm::vec4(0.0f)});
+    }
+
+    // Indices move with their vertices, the unused ones form degenerate triangles on the first vertex of the slot.
+    std::vector<unsigned int> spreadIndices;
+    unsigned int oldVertex = 0, oldIndex = 0, newVertex = 0;
+    for (const MeshSlot &slot : slots) {
+        assert(oldIndex + slot.indexCount <= indices.size());
+        for (unsigned int i = oldIndex; i < oldIndex + slot.indexCount; i++) {
+            spreadIndices.push_back(indices[i] - oldVertex + newVertex);
+        }
+        spreadIndices.resize(spreadIndices.size() + slot.indexCapacity - slot.indexCount, newVertex);
+        oldVertex += slot.vertexCount;
+        oldIndex += slot.indexCount;
+        newVertex += slot.vertexCapacity;
+    }
+    assert(oldIndex == indices.size());
+    indices.swap(spreadIndices);
+
+    dirtyVertices.clear();
+    dirtyIndices.clear();
+    addDirtyRange(dirtyVertices, 0, vertexCount());
+    addDirtyRange(dirtyIndices, 0, indices.size());
+    needUpdate = true;
+}
+
+
+template <class V>
+void Renderer::Mesh::spreadVertices(std::vector<V> &target, const std::vector<MeshSlot> &slots, const V &unused)
+{
+    std::vector<V> spread;
+    unsigned int oldVertex = 0;
+    for (const MeshSlot &slot : slots) {
+        assert(oldVertex + slot.vertexCount <= target.size());
+        spread.insert(spread.end(), target.begin() + oldVertex, target.begin() + oldVertex + slot.vertexCount);
+        spread.resize(spread.size() + slot.vertexCapacity - slot.vertexCount, unused);
+        oldVertex += slot.vertexCount;
+    }
+    assert(oldVertex == target.size());
+    target.swap(spread);
+}
+
+
+template <class V>
+void Renderer::Mesh::patchVertices(std::vector<V> &target, unsigned int vertexStart, unsigned int vertexCount, const std::vector<V> &newVertices)
+{
+    assert(vertexStart + vertexCount <= target.size());
+
+    long vertexShift = (long)newVertices.size() - (long)vertexCount;
+    if (vertexShift == 0) {
+        std::copy(newVertices.begin(), newVertices.end(), target.begin() + vertexStart);
+    } else {
+        target.erase(target.begin() + vertexStart, target.begin() + vertexStart + vertexCount);
+        target.insert(target.begin() + vertexStart, newVertices.begin(), newVertices.end());
+    }
+
+    // Everything behind a range of changed size moves.
+    unsigned int vertexEnd = vertexShift == 0 ? vertexStart + vertexCount : target.size();
+    addDirtyRange(dirtyVertices, vertexStart, vertexEnd);
+    needUpdate = true;
+}
+
+
+void Renderer::Mesh::patchIndices(unsigned int vertexStart, long vertexShift,
+    unsigned int indexStart, unsigned int indexCount, const std::vector<unsigned int> &newIndices)
+{
+    assert(indexStart + indexCount <= indices.size());
+
+    long indexShift = (long)newIndices.size() - (long)indexCount;
+    if (indexShift == 0) {
+        std::copy(newIndices.begin(), newIndices.end(), indices.begin() + indexStart);
+    } else {
+        indices.erase(indices.begin() + indexStart, indices.begin() + indexStart + indexCount);
+        indices.insert(indices.begin() + indexStart, newIndices.begin(), newIndices.end());
+    }
+    for (unsigned int i = indexStart; i < indexStart + newIndices.size(); i++) {
+        indices[i] += vertexStart;
+    }
+    if (vertexShift != 0) {
+        for (unsigned int i = indexStart + newIndices.size(); i < indices.size(); i++) {
+            indices[i] += vertexShift;
+        }
+    }
+
+    unsigned int indexEnd = vertexShift == 0 && indexShift == 0 ? indexStart + indexCount : indices.size();
+    addDirtyRange(dirtyIndices, indexStart, indexEnd);
+    needUpdate = true;
+}
+
 void Renderer::Mesh::draw()
 {
     glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
 }
 
 
+// Elements of the dirty ranges within the first count.
+static size_t dirtyCount(unsigned int count, const DirtyRanges &dirty)
+{
+    size_t size = 0;
+    for (const auto &range : dirty) {
+        if (range.first >= count) break;
+        size += std::min(range.second, count) - range.first;
+    }
+    return size;
+}
+
+size_t Renderer::Mesh::dirtyBytes()
+{
+    return dirtyCount(vertexCount(), dirtyVertices) * (packed ? sizeof(PackedVertex) : sizeof(Vertex))
+        + dirtyCount(indices.size(), dirtyIndices) * sizeof(unsigned int);
+}
+
+
 Renderer::Mesh Renderer::createMesh(std::vector<glm::vec3> &vertexPoints, std::vector<std::vector<unsigned int>> &indices, glm::vec4 color) {
     std::vector<Vertex> vertices;
     std::vector<unsigned int> indicesRet;
@@ -18,6 +18,7 @@
 #include <iostream>
 #include <vector>
 #include <memory>
+#include <utility>
 
 namespace Renderer {
 
@@ -38,6 +39,30 @@ struct Vertex {
     //glm::vec3 Bitangent;
 };
 
+// Compact vertex for voxel meshes. The position is stored in half voxel units, so that meshes centered
+// on a tilemap of odd size are representable. The normal indexes the face directions +x, -x, +y, -y, +z, -z
+// and the color indexes the palette which is uploaded together with the mesh.
+struct PackedVertex {
+    short position[3];
+    unsigned char normal;
+    unsigned char color;
+};
+
+static_assert(sizeof(PackedVertex) == 8, "PackedVertex must be 8 bytes");
+
+const int PACKED_PALETTE_SIZE = 256;
+const int PACKED_POSITION_LIMIT = 32767;
+const int PALETTE_BLOCK_BINDING = 3;
+
+
+// Range of a mesh whose first vertexCount vertices and indexCount indices are in use. The rest holds
+// unused vertices and degenerate triangles, so that the part can grow without moving the mesh behind it.
+struct MeshSlot {
+    unsigned int vertexCount, indexCount;
+    unsigned int vertexCapacity, indexCapacity;
+};
+
+
 /*struct Texture {
     unsigned int id;
     string type;
@@ -59,14 +84,65 @@ public:
         this->indices = indices;
         //this->textures = textures;
     }
+    // Mesh with packed vertices, whose colors index into the given palette.
+    Mesh(std::vector<PackedVertex> vertices, std::vector<unsigned int> indices, std::vector<glm::vec4> palette) : VAO(-1)
+    {
+        this->packed = true;
+        this->packedVertices = vertices;
+        this->indices = indices;
+        this->paletteColors = palette;
+        this->paletteColors.resize(PACKED_PALETTE_SIZE);
+    }
+    // Meshes copied straight from memory the caller keeps, e.g. a mapped file.
+    Mesh(const Vertex* vertices, unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount) : VAO(-1)
+    {
+        this->vertices.assign(vertices, vertices + vertexCount);
+        this->indices.assign(indices, indices + indexCount);
+    }
+    Mesh(const PackedVertex* vertices, unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount,
+        const std::vector<glm::vec4> &palette) : VAO(-1)
+    {
+        this->packed = true;
+        this->packedVertices.assign(vertices, vertices + vertexCount);
+        this->indices.assign(indices, indices + indexCount);
+        this->paletteColors = palette;
+        this->paletteColors.resize(PACKED_PALETTE_SIZE);
+    }
     ~Mesh() {
+        // Meshes which were never drawn have no gl objects, e.g. those of benchmarks.
+        if (VAO == (unsigned int)-1) {
+            return;
+        }
         glDeleteBuffers(1, &VBO);
         glDeleteBuffers(1, &EBO);
         glDeleteVertexArrays(1, &VAO);
+        if (packed) {
+            glDeleteBuffers(1, &paletteUBO);
+        }
     }
 
+    bool isPacked() { return this->packed; }
     unsigned int indexCount() { return this->indices.size(); }
-    unsigned int vertexCount() { return this->vertices.size(); }
+    unsigned int vertexCount() { return packed ? this->packedVertices.size() : this->vertices.size(); }
+    // Bytes of the vertex and index data. The gl buffers hold another copy.
+    size_t memoryUsage() {
+        return (packed ? packedVertices.size() * sizeof(PackedVertex) : vertices.size() * sizeof(Vertex))
+            + indices.size() * sizeof(unsigned int);
+    }
+
+    // Replaces vertexCount vertices starting at vertexStart and indexCount indices starting at indexStart.
+    // The new indices are relative to vertexStart, indices behind the replaced range are shifted if the
+    // number of vertices changes. Only the changed parts of the buffers are uploaded on the next setup:
+    // the replaced ranges if their sizes stay the same, otherwise everything behind them.
+    void patch(unsigned int vertexStart, unsigned int vertexCount, const std::vector<Vertex> &newVertices,
+        unsigned int indexStart, unsigned int indexCount, const std::vector<unsigned int> &newIndices);
+    void patch(unsigned int vertexStart, unsigned int vertexCount, const std::vector<PackedVertex> &newVertices,
+        unsigned int indexStart, unsigned int indexCount, const std::vector<unsigned int> &newIndices);
+
+    // Moves parts of the mesh which are stored back to back into slots: part i, the next slots[i].vertexCount
+    // vertices and slots[i].indexCount indices, gets slots[i].vertexCapacity vertices and slots[i].indexCapacity
+    // indices. The whole mesh is uploaded on the next setup.
+    void spread(const std::vector<MeshSlot> &slots);
 
     // initialize buffer objects/arrays. Needs to be called before prepareDraw whenever vertices or indices were changed.
     void setup(ShaderProgram& shaderProgram);
@@ -77,6 +153,15 @@ public:
     // actual draw call.
     void draw();
 
+    // Bytes of the ranges changed by patch since the last setup. Setup uploads only these unless the gl
+    // buffers do not exist yet or are too small.
+    size_t dirtyBytes();
+    // Forgets the changed ranges without uploading them, for measurements without a GL context.
+    void clearDirty() {
+        dirtyVertices.clear();
+        dirtyIndices.clear();
+    }
+
     private: 
         /*  Mesh Data  */
         std::vector<Vertex> vertices;
@@ -85,12 +170,45 @@ public:
         unsigned int VAO;
         unsigned int VBO, EBO;
 
+        // Packed meshes store their vertices in packedVertices and upload the palette as uniform block.
+        bool packed = false;
+        std::vector<PackedVertex> packedVertices;
+        std::vector<glm::vec4> paletteColors;
+        unsigned int paletteUBO;
+
+        // Allocated size of the gl buffers in elements and the ranges [begin, end) changed since the last
+        // upload, sorted and disjoint.
+        unsigned int vertexCapacity = 0, indexCapacity = 0;
+        std::vector<std::pair<unsigned int, unsigned int>> dirtyVertices, dirtyIndices;
+
+        template <class V>
+        static void spreadVertices(std::vector<V> &target, const std::vector<MeshSlot> &slots, const V &unused);
+        template <class V>
+        void patchVertices(std::vector<V> &target, unsigned int vertexStart, unsigned int vertexCount, const std::vector<V> &newVertices);
+        void patchIndices(unsigned int vertexStart, long vertexShift,
+            unsigned int indexStart, unsigned int indexCount, const std::vector<unsigned int> &newIndices);
+
 };
 
 
 // Mesh ids start at 1. ID 0 is reserved.
 MeshID newMesh(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices);
+MeshID newMesh(std::vector<PackedVertex> &vertices, std::vector<unsigned int> &indices, std::vector<glm::vec4> &palette);
 void updateMesh(MeshID id, std::vector<Vertex> &vertices, std::vector<unsigned int> &indices);
+void updateMesh(MeshID id, std::vector<PackedVertex> &vertices, std::vector<unsigned int> &indices, std::vector<glm::vec4> &palette);
+// Take the data from memory which only has to stay valid during the call. The mesh keeps its own copy, which
+// patchMesh edits and the next draw uploads.
+MeshID newMesh(const Vertex* vertices, unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount);
+MeshID newMesh(const PackedVertex* vertices, unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount,
+    std::vector<glm::vec4> &palette);
+void updateMesh(MeshID id, const Vertex* vertices, unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount);
+void updateMesh(MeshID id, const PackedVertex* vertices, unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount,
+    std::vector<glm::vec4> &palette);
+void patchMesh(MeshID id, unsigned int vertexStart, unsigned int vertexCount, std::vector<Vertex> &vertices,
+    unsigned int indexStart, unsigned int indexCount, std::vector<unsigned int> &indices);
+void patchMesh(MeshID id, unsigned int vertexStart, unsigned int vertexCount, std::vector<PackedVertex> &vertices,
+    unsigned int indexStart, unsigned int indexCount, std::vector<unsigned int> &indices);
+void spreadMesh(MeshID id, const std::vector<MeshSlot> &slots);
 void deleteMesh(MeshID meshID);
 std::shared_ptr<Mesh> getMesh(unsigned int id);
 
@@ -0,0 +1,139 @@
+#include "meshcache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include "mappedfile.h"
+
+
+namespace {
+const uint32_t CACHE_MAGIC = 'V' | 'X' << 8 | 'M' << 16 | 'C' << 24;
+// Must change whenever the mesher output changes.
+const uint32_t CACHE_VERSION = 3;
+
+struct Header {
+    uint32_t magic, version, vertexSize, packed;
+    uint32_t segmentCount, vertexCount, indexCount, reserved;
+    uint64_t hash;
+};
+// The arrays behind the header are read in place, their offsets keep the alignment of the mapping.
+static_assert(sizeof(Header) % 8 == 0 && sizeof(TileMap3d::MeshSegment) % 4 == 0
+    && sizeof(Renderer::Vertex) % 4 == 0 && sizeof(Renderer::PackedVertex) % 4 == 0, "cache arrays must stay aligned");
+
+// Points values at count elements at data and advances data.
+template <class T>
+void readArray(const uint8_t* &data, size_t count, const T* &values) {
+    values = (const T*)data;
+    data += count * sizeof(T);
+}
+
+// Moves the file at from to to, replacing a file which is already there.
+bool replaceFile(const std::string &from, const std::string &to) {
+#ifdef _WIN32
+    // rename never replaces existing files on Windows.
+    return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+template <class T>
+void writeArray(std::ofstream &out, const std::vector<T> &values) {
+    out.write((const char*)values.data(), values.size() * sizeof(T));
+}
+}
+
+
+MeshCache::MeshCache(const std::string &directory) : directory(directory) {
+#ifdef _WIN32
+    _mkdir(directory.c_str());
+#else
+    mkdir(directory.c_str(), 0755);
+#endif
+}
+
+
+std::string MeshCache::path(uint64_t hash) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.mesh", (unsigned long long)hash);
+    return directory + "/" + name;
+}
+
+
+bool MeshCache::load(uint64_t hash, int segmentCount, CachedMesh &mesh, std::vector<TileMap3d::MeshSegment> &segments) {
+    MappedFile &file = mesh.file;
+    Header header;
+    bool valid = file.open(path(hash)) && file.size() >= sizeof(Header);
+    if (valid) {
+        std::memcpy(&header, file.data(), sizeof(Header));
+        const size_t vertexSize = header.packed ? sizeof(Renderer::PackedVertex) : sizeof(Renderer::Vertex);
+        valid = header.magic == CACHE_MAGIC && header.version == CACHE_VERSION && header.hash == hash
+            && header.vertexSize == vertexSize && header.segmentCount == (uint32_t)segmentCount
+            && file.size() == sizeof(Header) + (size_t)header.segmentCount * sizeof(TileMap3d::MeshSegment)
+                + (size_t)header.vertexCount * vertexSize + (size_t)header.indexCount * sizeof(unsigned int);
+    }
+    if (!valid) {
+        file.close();
+        misses++;
+        return false;
+    }
+
+    const uint8_t* data = file.data() + sizeof(Header);
+    const TileMap3d::MeshSegment* segmentData;
+    readArray(data, header.segmentCount, segmentData);
+    segments.assign(segmentData, segmentData + header.segmentCount);
+    mesh.packed = header.packed != 0;
+    if (mesh.packed) {
+        readArray(data, header.vertexCount, mesh.packedVertices);
+    } else {
+        readArray(data, header.vertexCount, mesh.vertices);
+    }
+    readArray(data, header.indexCount, mesh.indices);
+    mesh.vertexCount = header.vertexCount;
+    mesh.indexCount = header.indexCount;
+    hits++;
+    return true;
+}
+
+
+bool MeshCache::store(uint64_t hash, const VoxelMesher::MeshBuffer &buffer, const std::vector<TileMap3d::MeshSegment> &segments) {
+    Header header;
+    header.magic = CACHE_MAGIC;
+    header.version = CACHE_VERSION;
+    header.vertexSize = buffer.packed ? sizeof(Renderer::PackedVertex) : sizeof(Renderer::Vertex);
+    header.packed = buffer.packed;
+    header.segmentCount = segments.size();
+    header.vertexCount = buffer.vertexCount();
+    header.indexCount = buffer.indices.size();
+    header.reserved = 0;
+    header.hash = hash;
+
+    // Written under a temporary name first, so readers never see a partial file.
+    const std::string target = path(hash);
+    const std::string temporary = target + ".tmp" + std::to_string(nextTemporary++);
+    std::ofstream out(temporary, std::ios::out | std::ios::binary);
+    out.write((const char*)&header, sizeof(Header));
+    writeArray(out, segments);
+    if (buffer.packed) {
+        writeArray(out, buffer.packedVertices);
+    } else {
+        writeArray(out, buffer.vertices);
+    }
+    writeArray(out, buffer.indices);
+    out.close();
+    // Replaces files which load rejected, e.g. truncated ones or those of older versions. Can fail
+    // on Windows while another thread maps the file.
+    if (!out || !replaceFile(temporary, target)) {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,58 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "mappedfile.h"
+#include "tilemap3d.h"
+#include "voxelmesher.h"
+
+
+// Mesh of a MeshCache file, read in place from its memory mapping. The pointers are valid while the
+// file stays open.
+struct CachedMesh {
+    MappedFile file;
+    bool packed = false;
+    // One of them is set, depending on packed.
+    const Renderer::Vertex* vertices = nullptr;
+    const Renderer::PackedVertex* packedVertices = nullptr;
+    const unsigned int* indices = nullptr;
+    unsigned int vertexCount = 0, indexCount = 0;
+};
+
+
+// Directory of generated tilemap meshes, one file per TileMap3d::meshHash, so that later runs load
+// the vertices and indices of unchanged models instead of meshing them. Files hold the raw vertex
+// structs, so they are only valid for the build which wrote them; stale or foreign files are ignored.
+// A hit keeps the file mapped, its vertices and indices go from the mapping to Renderer::newMesh,
+// which copies them once into the Mesh for patching. Safe to use from several threads.
+// Layout: "VXMC", uint32 version, uint32 vertex size, uint32 packed, uint32 segment count,
+//     uint32 vertex count, uint32 index count, uint32 0, uint64 hash, then the segments (TileMap3d::MeshSegment),
+//     the vertices and the indices.
+class MeshCache {
+    public:
+        // Creates the directory if it does not exist.
+        MeshCache(const std::string &directory);
+
+        // False on a miss, which includes files with another number of segments. Segments and the arrays
+        // of mesh are only set on a hit.
+        bool load(uint64_t hash, int segmentCount, CachedMesh &mesh, std::vector<TileMap3d::MeshSegment> &segments);
+        bool store(uint64_t hash, const VoxelMesher::MeshBuffer &buffer, const std::vector<TileMap3d::MeshSegment> &segments);
+
+        int getHits() const {return hits;}
+        int getMisses() const {return misses;}
+
+    private:
+        std::string directory;
+        std::atomic<int> hits {0}, misses {0};
+        // Suffix of temporary files, so concurrent stores of the same mesh do not collide.
+        std::atomic<int> nextTemporary {0};
+
+        std::string path(uint64_t hash) const;
+};
+
+
+#endif // MESHCACHE_H
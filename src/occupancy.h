@@ -0,0 +1,137 @@
+#ifndef OCCUPANCY_H
+#define OCCUPANCY_H
+
+#include <glm/vec3.hpp> // glm::ivec3
+
+#include <stdint.h>
+#include <vector>
+
+#include "brickmap.h"
+
+
+// One bit per voxel whether it is solid, i.e. hides the faces of its neighbours. Bits are stored in
+// columns along z with 64 voxels per word, plus a border of one voxel around the volume, so the
+// visible faces of 64 voxels are found with a few shifts and ANDs.
+class OccupancyMask {
+    public:
+        OccupancyMask() : size(0), words(0) {}
+
+        // Needs the same source interface as the mesher (see voxelmesher.h). The border is taken
+        // from source.isEmpty outside of the volume. If a brick map of the source is given, only
+        // the cells of its non-empty bricks are read.
+        template <class Source>
+        void build(const Source &source, const BrickMap *bricks = nullptr);
+
+        bool isBuilt() const {return !bits.empty();}
+        glm::ivec3 getSize() const {return size;}
+        int wordsPerColumn() const {return words;}
+
+        // Only for voxels inside the volume; the border does not change.
+        void set(int x, int y, int z, bool solid) {
+            uint64_t &word = bits[columnIndex(x, y) + (z >> 6)];
+            uint64_t bit = (uint64_t)1 << (z & 63);
+            word = solid ? (word | bit) : (word & ~bit);
+        }
+
+        bool get(int x, int y, int z) const {
+            return (bits[columnIndex(x, y) + (z >> 6)] >> (z & 63)) & 1;
+        }
+
+        // Voxels z = 64 * word + i of column (x, y) as bits i. x and y may lie on the border.
+        uint64_t column(int x, int y, int word) const {
+            return bits[columnIndex(x, y) + word];
+        }
+
+        // Solid voxels of the column word whose face in direction (+x, -x, +y, -y, +z, -z) is visible.
+        uint64_t visibleFaces(int x, int y, int word, int direction) const {
+            uint64_t solid = column(x, y, word);
+            uint64_t neighbour;
+            switch (direction) {
+                case 0: neighbour = column(x + 1, y, word); break;
+                case 1: neighbour = column(x - 1, y, word); break;
+                case 2: neighbour = column(x, y + 1, word); break;
+                case 3: neighbour = column(x, y - 1, word); break;
+                case 4: {
+                    neighbour = solid >> 1;
+                    if (word + 1 < words) {
+                        neighbour |= column(x, y, word + 1) << 63;
+                    } else if (zBorder[columnNumber(x, y)] & ABOVE_SOLID) {
+                        neighbour |= (uint64_t)1 << ((size.z - 1) & 63);
+                    }
+                    break;
+                }
+                default: {
+                    neighbour = solid << 1;
+                    if (word > 0) {
+                        neighbour |= column(x, y, word - 1) >> 63;
+                    } else if (zBorder[columnNumber(x, y)] & BELOW_SOLID) {
+                        neighbour |= 1;
+                    }
+                    break;
+                }
+            }
+            return solid & ~neighbour;
+        }
+
+    private:
+        static const uint8_t BELOW_SOLID = 1;
+        static const uint8_t ABOVE_SOLID = 2;
+
+        glm::ivec3 size;
+        int words;
+        std::vector<uint64_t> bits;
+        // Whether the voxels at z = -1 and z = size.z are solid, per column.
+        std::vector<uint8_t> zBorder;
+
+        int columnNumber(int x, int y) const {
+            return (x + 1) * (size.y + 2) + (y + 1);
+        }
+        int columnIndex(int x, int y) const {
+            return columnNumber(x, y) * words;
+        }
+};
+
+
+template <class Source>
+void OccupancyMask::build(const Source &source, const BrickMap *bricks) {
+    size = source.size();
+    words = (size.z + 63) / 64;
+    bits.assign((size.x + 2) * (size.y + 2) * words, 0);
+    zBorder.assign((size.x + 2) * (size.y + 2), 0);
+
+    if (bricks != nullptr) {
+        bricks->forEachBrick(glm::ivec3(0), size, [&](glm::ivec3 lo, glm::ivec3 hi) {
+            for (int x = lo.x; x < hi.x; x++) {
+                for (int y = lo.y; y < hi.y; y++) {
+                    uint64_t* column = &bits[columnIndex(x, y)];
+                    for (int z = lo.z; z < hi.z; z++) {
+                        column[z >> 6] |= (uint64_t)(source.get(x, y, z) != 0) << (z & 63);
+                    }
+                }
+            }
+        });
+    }
+
+    for (int x = -1; x <= size.x; x++) {
+        for (int y = -1; y <= size.y; y++) {
+            bool inside = x >= 0 && y >= 0 && x < size.x && y < size.y;
+            bool isCorner = (x < 0 || x == size.x) && (y < 0 || y == size.y);
+            if (isCorner) continue;
+
+            uint64_t* column = &bits[columnIndex(x, y)];
+            if (!inside || bricks == nullptr) {
+                for (int z = 0; z < size.z; z++) {
+                    bool solid = inside ? source.get(x, y, z) != 0 : !source.isEmpty(x, y, z);
+                    column[z >> 6] |= (uint64_t)solid << (z & 63);
+                }
+            }
+            if (inside) {
+                zBorder[columnNumber(x, y)] = (source.isEmpty(x, y, -1) ? 0 : BELOW_SOLID)
+                    | (source.isEmpty(x, y, size.z) ? 0 : ABOVE_SOLID);
+            }
+        }
+    }
+}
+
+
+#endif // OCCUPANCY_H
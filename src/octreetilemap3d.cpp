@@ -0,0 +1,308 @@
+
+#include "octreetilemap3d.h"
+#include "voxelmesher.h"
+
+
+OctreeTileMap3d::OctreeTileMap3d(const Palette palette, int xSize, int ySize, int zSize) :
+        palette(palette),
+        size(xSize, ySize, zSize),
+        depth(0)
+{
+    while ((1 << depth) < std::max(xSize, std::max(ySize, zSize))) {
+        depth++;
+    }
+    nodes.push_back({0, 0});
+}
+
+
+unsigned int OctreeTileMap3d::get(int x, int y, int z) const {
+    if (!inBounds(x, y, z)) {
+        return 0;
+    }
+    const glm::ivec3 p(x, y, z);
+    uint32_t node = 0;
+    int level = depth;
+    while (nodes[node].firstChild != 0) {
+        if (nodes[node].firstChild & BRICK) {
+            return bricks[nodes[node].firstChild & ~BRICK].values[childIndex(p, 0)];
+        }
+        level--;
+        node = nodes[node].firstChild + childIndex(p, level);
+    }
+    return nodes[node].value;
+}
+
+unsigned int OctreeTileMap3d::get(glm::ivec3 k) const {
+    return get(k.x, k.y, k.z);
+}
+
+Tile OctreeTileMap3d::getTile(int x, int y, int z) const {
+    return palette[get(x, y, z)];
+}
+
+Tile OctreeTileMap3d::getTile(glm::ivec3 k) const {
+    return getTile(k.x, k.y, k.z);
+}
+
+
+void OctreeTileMap3d::set(int x, int y, int z, unsigned int value) {
+    if (value >= palette.size()) {
+        throw std::invalid_argument( "Tile index " + std::to_string(value) + " out of range: 0 - " + std::to_string(palette.size()) );
+    }
+    if (!inBounds(x, y, z)) {
+        throw std::invalid_argument( "Position (" + std::to_string(x) + ", " + std::to_string(y) + ", " + std::to_string(z) + ") outside of the tilemap" );
+    }
+    setNode(0, depth, glm::ivec3(x, y, z), value);
+    meshOutdated = true;
+}
+
+void OctreeTileMap3d::set(glm::ivec3 k, unsigned int v) {
+    set(k.x, k.y, k.z, v);
+}
+
+
+uint32_t OctreeTileMap3d::allocateChildren(unsigned int value) {
+    uint32_t first;
+    if (!freeBlocks.empty()) {
+        first = freeBlocks.back();
+        freeBlocks.pop_back();
+    } else {
+        first = nodes.size();
+        nodes.resize(nodes.size() + 8);
+    }
+    for (int i = 0; i < 8; i++) {
+        nodes[first + i] = {0, value};
+    }
+    return first;
+}
+
+
+uint32_t OctreeTileMap3d::allocateBrick(unsigned int value) {
+    uint32_t brick;
+    if (!freeBricks.empty()) {
+        brick = freeBricks.back();
+        freeBricks.pop_back();
+    } else {
+        brick = bricks.size();
+        bricks.emplace_back();
+    }
+    std::fill_n(bricks[brick].values, 8, value);
+    return brick;
+}
+
+
+// Sets a voxel of a node with 2x2x2 voxels stored as a brick. Returns false if the node is not a
+// brick and cannot become one.
+bool OctreeTileMap3d::setBrick(uint32_t node, glm::ivec3 p, unsigned int value) {
+    Node &n = nodes[node];
+    if (n.firstChild == 0) {
+        if (value > UINT8_MAX || n.value > UINT8_MAX) {
+            return false;
+        }
+        n.firstChild = BRICK | allocateBrick(n.value);
+    } else if (!(n.firstChild & BRICK)) {
+        return false;
+    } else if (value > UINT8_MAX) {
+        // Convert back to leaves for indices which do not fit into a byte.
+        const uint32_t brick = n.firstChild & ~BRICK;
+        const uint32_t first = allocateChildren(0);
+        for (int i = 0; i < 8; i++) {
+            nodes[first + i].value = bricks[brick].values[i];
+        }
+        nodes[node].firstChild = first;
+        freeBricks.push_back(brick);
+        return false;
+    }
+
+    Brick &brick = bricks[n.firstChild & ~BRICK];
+    brick.values[childIndex(p, 0)] = value;
+
+    bool uniform = true, solid = true;
+    for (int i = 0; i < 8; i++) {
+        uniform = uniform && brick.values[i] == brick.values[0];
+        solid = solid && brick.values[i] != 0;
+    }
+    if (uniform) {
+        freeBricks.push_back(n.firstChild & ~BRICK);
+        n = {0, brick.values[0]};
+    } else {
+        n.value = solid;
+    }
+    return true;
+}
+
+
+void OctreeTileMap3d::setNode(uint32_t node, int level, glm::ivec3 p, unsigned int value) {
+    if (nodes[node].firstChild == 0 && nodes[node].value == value) {
+        return;
+    }
+    if (level == 1 && setBrick(node, p, value)) {
+        return;
+    }
+    if (nodes[node].firstChild == 0) {
+        if (level == 0) {
+            nodes[node].value = value;
+            return;
+        }
+        // Allocating may move nodes, so nodes are only accessed by index.
+        uint32_t first = allocateChildren(nodes[node].value);
+        nodes[node].firstChild = first;
+    }
+    setNode(nodes[node].firstChild + childIndex(p, level - 1), level - 1, p, value);
+
+    // Merge the children if they became uniform leaves, otherwise update whether the node is solid.
+    const uint32_t first = nodes[node].firstChild;
+    bool uniform = true, solid = true;
+    for (int i = 0; i < 8; i++) {
+        const Node &child = nodes[first + i];
+        uniform = uniform && child.firstChild == 0 && child.value == nodes[first].value;
+        solid = solid && child.value != 0;
+    }
+    if (uniform) {
+        nodes[node] = {0, nodes[first].value};
+        freeBlocks.push_back(first);
+    } else {
+        nodes[node].value = solid;
+    }
+}
+
+
+glm::vec3 OctreeTileMap3d::center() const {
+    return glm::vec3(size) * 0.5f;
+}
+
+
+bool OctreeTileMap3d::isEmptyFace(glm::ivec3 p) const {
+    if (!inBounds(p.x, p.y, p.z)) {
+        return showBoundaries;
+    }
+    return get(p) == 0;
+}
+
+
+void OctreeTileMap3d::meshVoxel(glm::ivec3 p, unsigned int tileState, glm::vec3 offset,
+    VoxelMesher::MeshBuffer &out, std::vector<std::vector<glm::ivec3>> *faces) const
+{
+    int firstSegment = 0;
+    for (const VoxelMesher::FaceDirection &dir : VoxelMesher::faceDirections) {
+        glm::ivec3 neighbour = p;
+        neighbour[dir.axis] += dir.sign;
+        if (isEmptyFace(neighbour)) {
+            if (faces != nullptr) {
+                (*faces)[firstSegment + p[dir.axis]].emplace_back(p[dir.uAxis], p[dir.vAxis], tileState);
+            } else {
+                VoxelMesher::addQuad(out, dir, p[dir.axis], p[dir.uAxis], p[dir.vAxis], 1, 1, palette, tileState, offset);
+            }
+        }
+        firstSegment += size[dir.axis];
+    }
+}
+
+
+// Solid nodes lie completely inside of the map, since voxels outside of it are empty. Only the voxels
+// on their surface can have visible faces, so their interior is never visited.
+// Faces are either added as quads or, for greedy meshing, collected as (u, v, value) per segment.
+void OctreeTileMap3d::meshNode(uint32_t node, glm::ivec3 origin, int level, glm::vec3 offset,
+    VoxelMesher::MeshBuffer &out, std::vector<std::vector<glm::ivec3>> *faces) const
+{
+    const Node &n = nodes[node];
+    if (n.firstChild == 0 && n.value == 0) {
+        return;
+    }
+
+    if (n.value != 0) {
+        const int s = 1 << level;
+        int firstSegment = 0;
+        for (const VoxelMesher::FaceDirection &dir : VoxelMesher::faceDirections) {
+            glm::ivec3 p;
+            p[dir.axis] = dir.sign > 0 ? origin[dir.axis] + s - 1 : origin[dir.axis];
+            for (int v = 0; v < s; v++) {
+                p[dir.vAxis] = origin[dir.vAxis] + v;
+                for (int u = 0; u < s; u++) {
+                    p[dir.uAxis] = origin[dir.uAxis] + u;
+                    glm::ivec3 neighbour = p;
+                    neighbour[dir.axis] += dir.sign;
+                    if (!isEmptyFace(neighbour)) continue;
+
+                    unsigned int tileState = n.firstChild == 0 ? n.value : get(p);
+                    if (faces != nullptr) {
+                        (*faces)[firstSegment + p[dir.axis]].emplace_back(p[dir.uAxis], p[dir.vAxis], tileState);
+                    } else {
+                        VoxelMesher::addQuad(out, dir, p[dir.axis], p[dir.uAxis], p[dir.vAxis], 1, 1, palette, tileState, offset);
+                    }
+                }
+            }
+            firstSegment += size[dir.axis];
+        }
+        return;
+    }
+
+    if (n.firstChild & BRICK) {
+        const Brick &brick = bricks[n.firstChild & ~BRICK];
+        for (int i = 0; i < 8; i++) {
+            if (brick.values[i] != 0) {
+                meshVoxel(origin + glm::ivec3((i >> 2) & 1, (i >> 1) & 1, i & 1), brick.values[i], offset, out, faces);
+            }
+        }
+        return;
+    }
+
+    const int half = 1 << (level - 1);
+    for (int i = 0; i < 8; i++) {
+        glm::ivec3 childOrigin = origin + half * glm::ivec3((i >> 2) & 1, (i >> 1) & 1, i & 1);
+        meshNode(n.firstChild + i, childOrigin, level - 1, offset, out, faces);
+    }
+}
+
+
+void OctreeTileMap3d::generateMesh(VoxelMesher::MeshBuffer &buffer) const {
+    const glm::vec3 offset = makeMeshCentered ? center() : glm::vec3(0.0f);
+    if (meshingMode == MeshingMode::GREEDY) {
+        // Same slices and merging as the dense greedy mesher, but the masks are filled from the
+        // collected faces and slices without faces are skipped.
+        std::vector<std::vector<glm::ivec3>> faces(VoxelMesher::segmentCount(size, meshingMode));
+        meshNode(0, glm::ivec3(0), depth, offset, buffer, &faces);
+
+        std::vector<unsigned int> mask;
+        int segment = 0;
+        for (const VoxelMesher::FaceDirection &dir : VoxelMesher::faceDirections) {
+            const int sizeU = size[dir.uAxis];
+            const int sizeV = size[dir.vAxis];
+            for (int slice = 0; slice < size[dir.axis]; slice++, segment++) {
+                if (faces[segment].empty()) continue;
+                mask.assign(sizeU * sizeV, 0);
+                for (const glm::ivec3 &face : faces[segment]) {
+                    mask[face.x + face.y * sizeU] = face.z;
+                }
+                VoxelMesher::greedyMergeMask(mask, sizeU, sizeV, dir, slice, palette, offset, buffer);
+            }
+        }
+    } else {
+        meshNode(0, glm::ivec3(0), depth, offset, buffer, nullptr);
+    }
+}
+
+
+void OctreeTileMap3d::updateMesh() {
+    if (!meshOutdated) {
+        return;
+    }
+
+    VoxelMesher::MeshBuffer buffer;
+    buffer.packed = packedVertices && VoxelMesher::canPack(palette, size);
+    generateMesh(buffer);
+
+    if (buffer.packed) {
+        std::vector<glm::vec4> colors = VoxelMesher::packedPalette(palette);
+        if (meshID == 0) {
+            meshID = Renderer::newMesh(buffer.packedVertices, buffer.indices, colors);
+        } else {
+            Renderer::updateMesh(meshID, buffer.packedVertices, buffer.indices, colors);
+        }
+    } else if (meshID == 0) {
+        meshID = Renderer::newMesh(buffer.vertices, buffer.indices);
+    } else {
+        Renderer::updateMesh(meshID, buffer.vertices, buffer.indices);
+    }
+    meshOutdated = false;
+}
@@ -0,0 +1,162 @@
+#ifndef OCTREETILEMAP3D_H
+#define OCTREETILEMAP3D_H
+
+#include <glm/vec3.hpp> // glm::vec3
+
+#include <stdint.h>
+#include <vector>
+
+#include "mesh.h"
+#include "tilemap3d.h"
+
+
+namespace VoxelMesher {
+struct MeshBuffer;
+}
+
+
+// Tilemap stored as a sparse voxel octree, for large static models which are mostly empty or
+// consist of large uniform regions. The tree covers a cube of 2^depth voxels containing the
+// map; voxels outside of the map are empty. Nodes whose voxels all hold the same value are
+// leaves, so empty space and uniform solid regions cost a single node.
+// Meshing only visits the surface of nodes which are completely solid and skips empty nodes.
+// Like TileMap3d, palette index 0 is reserved for empty voxels.
+class OctreeTileMap3d {
+    public:
+        Renderer::MeshID meshID = 0;
+        bool meshOutdated = true;
+        bool makeMeshCentered = true;
+        bool showBoundaries = true;
+        MeshingMode meshingMode = MeshingMode::NAIVE;
+        bool packedVertices = false;
+
+        OctreeTileMap3d(const Palette palette, int xSize, int ySize, int zSize);
+
+        // Voxels outside of the map are empty.
+        unsigned int get(int x, int y, int z) const;
+        unsigned int get(glm::ivec3 k) const;
+
+        Tile getTile(int x, int y, int z) const;
+        Tile getTile(glm::ivec3 k) const;
+
+        // Splits leaves down to the voxel and merges nodes which became uniform again.
+        void set(int x, int y, int z, unsigned int value);
+        void set(glm::ivec3 k, unsigned int v);
+
+        // Calls f(glm::ivec3 position, unsigned int value) for all non-empty voxels in [lo, hi),
+        // skipping empty nodes.
+        template <class F>
+        void forEachInBox(glm::ivec3 lo, glm::ivec3 hi, F f) const;
+
+        // Generates the mesh with the current options without uploading it.
+        void generateMesh(VoxelMesher::MeshBuffer &out) const;
+        void updateMesh();
+
+        glm::vec3 center() const;
+        int getXSize() const {return size.x;}
+        int getYSize() const {return size.y;}
+        int getZSize() const {return size.z;}
+
+        int nodeCount() const {return nodes.size() - 8 * freeBlocks.size();}
+        size_t memoryUsage() const {
+            return nodes.size() * sizeof(Node) + bricks.size() * sizeof(Brick)
+                + (freeBlocks.size() + freeBricks.size()) * sizeof(uint32_t);
+        }
+
+        Palette palette;
+
+        // Leaves have firstChild = 0 and value is their palette index. Inner nodes have 8 consecutive
+        // children at firstChild, child i covers the octant with offset (i >> 2, i >> 1, i) & 1, and
+        // value is 1 if all voxels of the node are non-empty, otherwise 0.
+        // Inner nodes of 2x2x2 voxels with indices below 256 store them in a Brick instead of 8 leaves;
+        // firstChild is then BRICK | brick index.
+        struct Node {
+            uint32_t firstChild;
+            uint32_t value;
+        };
+        struct Brick {
+            uint8_t values[8];
+        };
+        static const uint32_t BRICK = 0x80000000;
+
+    private:
+        glm::ivec3 size;
+        int depth;
+        std::vector<Node> nodes;
+        std::vector<Brick> bricks;
+        // Unused blocks of 8 nodes and unused bricks, reused before nodes or bricks grow.
+        std::vector<uint32_t> freeBlocks;
+        std::vector<uint32_t> freeBricks;
+
+        bool inBounds(int x, int y, int z) const {
+            return x >= 0 && y >= 0 && z >= 0 && x < size.x && y < size.y && z < size.z;
+        }
+        static int childIndex(glm::ivec3 p, int level) {
+            return (((p.x >> level) & 1) << 2) | (((p.y >> level) & 1) << 1) | ((p.z >> level) & 1);
+        }
+
+        uint32_t allocateChildren(unsigned int value);
+        uint32_t allocateBrick(unsigned int value);
+        void setNode(uint32_t node, int level, glm::ivec3 p, unsigned int value);
+        bool setBrick(uint32_t node, glm::ivec3 p, unsigned int value);
+
+        template <class F>
+        void forEachInBox(uint32_t node, glm::ivec3 origin, int level, glm::ivec3 lo, glm::ivec3 hi, F &f) const;
+
+        bool isEmptyFace(glm::ivec3 p) const;
+        void meshVoxel(glm::ivec3 p, unsigned int tileState, glm::vec3 offset,
+            VoxelMesher::MeshBuffer &out, std::vector<std::vector<glm::ivec3>> *faces) const;
+        void meshNode(uint32_t node, glm::ivec3 origin, int level, glm::vec3 offset,
+            VoxelMesher::MeshBuffer &out, std::vector<std::vector<glm::ivec3>> *faces) const;
+};
+
+
+template <class F>
+void OctreeTileMap3d::forEachInBox(glm::ivec3 lo, glm::ivec3 hi, F f) const {
+    lo = glm::max(lo, glm::ivec3(0));
+    hi = glm::min(hi, size);
+    if (lo.x >= hi.x || lo.y >= hi.y || lo.z >= hi.z) {
+        return;
+    }
+    forEachInBox(0, glm::ivec3(0), depth, lo, hi, f);
+}
+
+
+template <class F>
+void OctreeTileMap3d::forEachInBox(uint32_t node, glm::ivec3 origin, int level, glm::ivec3 lo, glm::ivec3 hi, F &f) const {
+    const Node &n = nodes[node];
+    const glm::ivec3 end = origin + (1 << level);
+    if (glm::any(glm::greaterThanEqual(origin, hi)) || glm::any(glm::lessThanEqual(end, lo))) {
+        return;
+    }
+    if (n.firstChild & BRICK) {
+        const Brick &brick = bricks[n.firstChild & ~BRICK];
+        for (int i = 0; i < 8; i++) {
+            glm::ivec3 p = origin + glm::ivec3((i >> 2) & 1, (i >> 1) & 1, i & 1);
+            if (brick.values[i] != 0 && glm::all(glm::greaterThanEqual(p, lo)) && glm::all(glm::lessThan(p, hi))) {
+                f(p, (unsigned int)brick.values[i]);
+            }
+        }
+        return;
+    }
+    if (n.firstChild == 0) {
+        if (n.value == 0) return;
+        glm::ivec3 from = glm::max(origin, lo), to = glm::min(end, hi);
+        for (int x = from.x; x < to.x; x++) {
+            for (int y = from.y; y < to.y; y++) {
+                for (int z = from.z; z < to.z; z++) {
+                    f(glm::ivec3(x, y, z), n.value);
+                }
+            }
+        }
+        return;
+    }
+    const int half = 1 << (level - 1);
+    for (int i = 0; i < 8; i++) {
+        glm::ivec3 childOrigin = origin + half * glm::ivec3((i >> 2) & 1, (i >> 1) & 1, i & 1);
+        forEachInBox(n.firstChild + i, childOrigin, level - 1, lo, hi, f);
+    }
+}
+
+
+#endif // OCTREETILEMAP3D_H
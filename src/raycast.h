@@ -0,0 +1,196 @@
+#ifndef RAYCAST_H
+#define RAYCAST_H
+
+#include <glm/vec3.hpp> // glm::vec3, glm::ivec3
+#include <glm/common.hpp> // glm::clamp
+#include <glm/geometric.hpp> // glm::length
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "brickmap.h"
+#include "threadpool.h"
+
+
+struct Ray {
+    glm::vec3 origin;
+    // Does not need to be normalized.
+    glm::vec3 direction;
+    float maxDistance = std::numeric_limits<float>::infinity();
+};
+
+struct RayHit {
+    bool hit = false;
+    // Along the normalized direction, in voxels.
+    float distance = 0.0f;
+    glm::vec3 position = glm::vec3(0.0f);
+    glm::ivec3 voxel = glm::ivec3(0);
+    // Outward normal of the face the ray entered through. Zero if the ray starts inside the voxel.
+    glm::ivec3 normal = glm::ivec3(0);
+    unsigned int value = 0;
+};
+
+
+// Amanatides-Woo voxel traversal. Rays are given in voxel space, voxel (x, y, z) covers
+// [x, x + 1) x [y, y + 1) x [z, z + 1). The source needs size() and get(x, y, z) as for the mesher
+// (see voxelmesher.h), the brick map must belong to it. Empty bricks of any level are crossed in one
+// step instead of voxel by voxel.
+namespace VoxelRaycast {
+
+// First non-empty voxel along the ray within maxDistance.
+template <class Source>
+RayHit cast(const Source &source, const BrickMap &bricks, const Ray &ray);
+
+// Casts all rays on the shared thread pool. The source must not change meanwhile.
+template <class Source>
+std::vector<RayHit> castMany(const Source &source, const BrickMap &bricks, const std::vector<Ray> &rays);
+
+
+// Rays per job of castMany.
+const int BATCH_SIZE = 64;
+
+
+template <class Source>
+RayHit cast(const Source &source, const BrickMap &bricks, const Ray &ray) {
+    RayHit result;
+    const float length = glm::length(ray.direction);
+    if (length == 0.0f) {
+        return result;
+    }
+    const glm::vec3 origin = ray.origin;
+    const glm::vec3 dir = ray.direction / length;
+    const glm::ivec3 size = source.size();
+    const float infinity = std::numeric_limits<float>::infinity();
+
+    glm::ivec3 step;
+    glm::vec3 invDir;
+    for (int a = 0; a < 3; a++) {
+        step[a] = dir[a] > 0.0f ? 1 : (dir[a] < 0.0f ? -1 : 0);
+        invDir[a] = dir[a] != 0.0f ? 1.0f / dir[a] : infinity;
+    }
+
+    // Distance to the plane at coordinate c on axis a.
+    auto planeDistance = [&](int a, float c) {
+        return step[a] == 0 ? infinity : (c - origin[a]) * invDir[a];
+    };
+
+    // Clip the ray to the volume.
+    float tEnter = 0.0f, tEnd = ray.maxDistance;
+    int axis = -1;
+    for (int a = 0; a < 3; a++) {
+        if (step[a] == 0) {
+            if (origin[a] < 0.0f || origin[a] >= size[a]) return result;
+            continue;
+        }
+        float tNear = planeDistance(a, step[a] > 0 ? 0.0f : (float)size[a]);
+        float tFar = planeDistance(a, step[a] > 0 ? (float)size[a] : 0.0f);
+        if (tNear > tEnter) {
+            tEnter = tNear;
+            axis = a;
+        }
+        tEnd = std::min(tEnd, tFar);
+    }
+    if (tEnter > tEnd) {
+        return result;
+    }
+
+    // Cell at distance t. Entered through axis, the cell on that axis is exact.
+    auto cellAt = [&](float t, int axis, int boundary) {
+        glm::ivec3 cell;
+        for (int a = 0; a < 3; a++) {
+            cell[a] = a == axis ? boundary : (int)std::floor(origin[a] + dir[a] * t);
+        }
+        return glm::clamp(cell, glm::ivec3(0), size - 1);
+    };
+
+    float t = tEnter;
+    glm::ivec3 cell = cellAt(t, axis, axis < 0 ? 0 : (step[axis] > 0 ? 0 : size[axis] - 1));
+    glm::vec3 tMax, tDelta;
+    auto initMax = [&]() {
+        for (int a = 0; a < 3; a++) {
+            tMax[a] = planeDistance(a, (float)(cell[a] + (step[a] > 0)));
+            tDelta[a] = std::abs(invDir[a]);
+        }
+    };
+    initMax();
+
+    // Level 0 brick known to be non-empty, the hierarchy is only checked when the ray leaves it.
+    glm::ivec3 solidBrick(-1);
+    while (t <= tEnd) {
+        const glm::ivec3 brick = cell >> BrickMap::BRICK_BITS;
+        int level = brick == solidBrick ? -1 : bricks.emptyLevel(cell);
+        if (level < 0) {
+            solidBrick = brick;
+        } else {
+            // Leave the empty brick through its nearest exit plane.
+            const int bits = BrickMap::BRICK_BITS * (level + 1);
+            const glm::ivec3 lo = (cell >> bits) << bits;
+            const glm::ivec3 hi = lo + (1 << bits);
+            float tExit = infinity;
+            for (int a = 0; a < 3; a++) {
+                float tPlane = planeDistance(a, (float)(step[a] > 0 ? hi[a] : lo[a]));
+                if (tPlane < tExit) {
+                    tExit = tPlane;
+                    axis = a;
+                }
+            }
+            if (axis < 0 || tExit > tEnd) {
+                return result;
+            }
+            int next = step[axis] > 0 ? hi[axis] : lo[axis] - 1;
+            if (next < 0 || next >= size[axis]) {
+                return result;
+            }
+            t = std::max(t, tExit);
+            for (int a = 0; a < 3; a++) {
+                cell[a] = a == axis ? next
+                    : glm::clamp((int)std::floor(origin[a] + dir[a] * t), lo[a], std::min(hi[a], size[a]) - 1);
+            }
+            initMax();
+            continue;
+        }
+
+        unsigned int value = source.get(cell.x, cell.y, cell.z);
+        if (value != 0) {
+            result.hit = true;
+            result.distance = t;
+            result.position = origin + dir * t;
+            result.voxel = cell;
+            if (axis >= 0) {
+                result.normal[axis] = -step[axis];
+            }
+            result.value = value;
+            return result;
+        }
+
+        axis = tMax.x < tMax.y ? (tMax.x < tMax.z ? 0 : 2) : (tMax.y < tMax.z ? 1 : 2);
+        t = tMax[axis];
+        cell[axis] += step[axis];
+        if (cell[axis] < 0 || cell[axis] >= size[axis]) {
+            return result;
+        }
+        tMax[axis] += tDelta[axis];
+    }
+    return result;
+}
+
+
+template <class Source>
+std::vector<RayHit> castMany(const Source &source, const BrickMap &bricks, const std::vector<Ray> &rays) {
+    std::vector<RayHit> hits(rays.size());
+    const int batches = (rays.size() + BATCH_SIZE - 1) / BATCH_SIZE;
+    ThreadPool::shared().parallelFor(batches, [&](int batch) {
+        const size_t end = std::min(rays.size(), (size_t)(batch + 1) * BATCH_SIZE);
+        for (size_t i = (size_t)batch * BATCH_SIZE; i < end; i++) {
+            hits[i] = cast(source, bricks, rays[i]);
+        }
+    });
+    return hits;
+}
+
+}
+
+
+#endif // RAYCAST_H
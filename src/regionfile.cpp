@@ -0,0 +1,208 @@
+#include "regionfile.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+
+namespace {
+const uint32_t REGION_MAGIC = 'V' | 'X' << 8 | 'R' << 16 | 'G' << 24;
+const uint32_t REGION_VERSION = 1;
+const size_t PREAMBLE_BYTES = 3 * sizeof(uint32_t);
+const size_t ENTRY_BYTES = 16;
+// Space for chunk data is reserved in multiples of this, so that small growth is rewritten in place.
+const uint32_t CHUNK_ALIGNMENT = 256;
+const size_t CHUNK_CELLS = ChunkedTileMap3d::CHUNK_SIZE * ChunkedTileMap3d::CHUNK_SIZE * ChunkedTileMap3d::CHUNK_SIZE;
+}
+
+
+bool RegionFile::open(const std::string &path) {
+    close();
+    this->path = path;
+    const size_t headerBytes = PREAMBLE_BYTES + REGION_CHUNKS * ENTRY_BYTES;
+
+    if (!file.open(path)) {
+        std::ofstream out(path, std::ios::out | std::ios::binary);
+        const uint32_t preamble[3] = {REGION_MAGIC, REGION_VERSION, (uint32_t)ChunkedTileMap3d::CHUNK_SIZE};
+        std::vector<char> emptyTable(REGION_CHUNKS * ENTRY_BYTES, 0);
+        out.write((const char*)preamble, sizeof(preamble));
+        out.write(emptyTable.data(), emptyTable.size());
+        out.close();
+        if (!out || !file.open(path)) {
+            error("cannot create region file");
+            return false;
+        }
+    }
+
+    uint32_t preamble[3];
+    if (file.size() < headerBytes) {
+        error("file is too short for a region file");
+        file.close();
+        return false;
+    }
+    std::memcpy(preamble, file.data(), sizeof(preamble));
+    if (preamble[0] != REGION_MAGIC || preamble[1] != REGION_VERSION || preamble[2] != (uint32_t)ChunkedTileMap3d::CHUNK_SIZE) {
+        error("not a region file of this version and chunk size");
+        file.close();
+        return false;
+    }
+    table.resize(REGION_CHUNKS);
+    std::memcpy(table.data(), file.data() + PREAMBLE_BYTES, REGION_CHUNKS * ENTRY_BYTES);
+    fileEnd = file.size();
+    return true;
+}
+
+
+void RegionFile::close() {
+    out.close();
+    out.clear();
+    file.close();
+    table.clear();
+    fileEnd = 0;
+}
+
+
+bool RegionFile::readChunk(glm::ivec3 local, CellStorage &cells) {
+    if (!hasChunk(local)) {
+        return false;
+    }
+    const Entry &entry = table[index(local)];
+    if (entry.offset + entry.size > file.size() && !file.open(path)) {
+        error("cannot map region file");
+        return false;
+    }
+    if (entry.size < 1 || entry.offset + entry.size > file.size()) {
+        error("chunk lies outside of the file");
+        return false;
+    }
+
+    const uint8_t* data = file.data() + entry.offset;
+    if (data[0] > (uint8_t)CellType::PALETTE_PACKED) {
+        error("unknown cell type");
+        return false;
+    }
+    try {
+        cells = CellStorage::decodeRuns((CellType)data[0], CHUNK_CELLS, data + 1, entry.size - 1);
+    } catch (const std::invalid_argument &e) {
+        error(e.what());
+        return false;
+    }
+    return true;
+}
+
+
+bool RegionFile::writeChunk(glm::ivec3 local, const CellStorage &cells) {
+    if (cells.size() != CHUNK_CELLS) {
+        throw std::invalid_argument( "Chunk content must have " + std::to_string(CHUNK_CELLS) + " cells" );
+    }
+    std::vector<uint8_t> data = cells.encodeRuns();
+    data.insert(data.begin(), (uint8_t)cells.getType());
+    return writeEntry(index(local), data);
+}
+
+
+bool RegionFile::removeChunk(glm::ivec3 local) {
+    return writeEntry(index(local), std::vector<uint8_t>());
+}
+
+
+bool RegionFile::writeEntry(int i, const std::vector<uint8_t> &data) {
+    if (table.empty()) {
+        return false;
+    }
+    Entry entry = table[i];
+    bool append = false;
+    if (data.empty()) {
+        entry = {0, 0, 0};
+    } else if (entry.offset == 0 || data.size() > entry.capacity) {
+        entry.offset = fileEnd;
+        entry.capacity = (data.size() + CHUNK_ALIGNMENT - 1) / CHUNK_ALIGNMENT * CHUNK_ALIGNMENT;
+        append = true;
+    }
+    entry.size = data.size();
+
+    if (!out.is_open()) {
+        out.open(path, std::ios::in | std::ios::out | std::ios::binary);
+    }
+    if (!data.empty()) {
+        out.seekp(entry.offset);
+        out.write((const char*)data.data(), data.size());
+        if (append) {
+            std::vector<char> padding(entry.capacity - data.size(), 0);
+            out.write(padding.data(), padding.size());
+        }
+    }
+    // The entry is written last, a failed write leaves the old data reachable.
+    out.seekp(PREAMBLE_BYTES + i * ENTRY_BYTES);
+    out.write((const char*)&entry, ENTRY_BYTES);
+    out.flush();
+    if (!out) {
+        // Cleared for the next write, which opens the file again if opening failed.
+        out.clear();
+        error("cannot write chunk");
+        return false;
+    }
+    table[i] = entry;
+    if (append) {
+        fileEnd = entry.offset + entry.capacity;
+    }
+    return true;
+}
+
+
+void RegionFile::error(const std::string &info) const {
+    std::cout << "[Error] RegionFile " << path << " :: " << info << std::endl;
+}
+
+
+RegionStore::RegionStore(const std::string &directory) : directory(directory) {
+}
+
+
+RegionFile* RegionStore::region(glm::ivec3 key, bool create) {
+    const glm::ivec3 regionKey = RegionFile::regionCoord(key);
+    auto it = regions.find(regionKey);
+    if (it != regions.end()) {
+        return it->second.get();
+    }
+    const std::string path = directory + "/r." + std::to_string(regionKey.x) + "." + std::to_string(regionKey.y)
+        + "." + std::to_string(regionKey.z) + ".vxr";
+    if (!create && !std::ifstream(path).good()) {
+        return nullptr;
+    }
+    std::unique_ptr<RegionFile> file(new RegionFile());
+    if (!file->open(path)) {
+        return nullptr;
+    }
+    return (regions[regionKey] = std::move(file)).get();
+}
+
+
+bool RegionStore::loadChunk(glm::ivec3 key, CellStorage &cells) {
+    std::lock_guard<std::mutex> lock(mutex);
+    RegionFile* file = region(key, false);
+    return file != nullptr && file->readChunk(RegionFile::localCoord(key), cells);
+}
+
+
+bool RegionStore::saveChunk(glm::ivec3 key, const CellStorage &cells) {
+    std::lock_guard<std::mutex> lock(mutex);
+    RegionFile* file = region(key, true);
+    return file != nullptr && file->writeChunk(RegionFile::localCoord(key), cells);
+}
+
+
+bool RegionStore::removeChunk(glm::ivec3 key) {
+    std::lock_guard<std::mutex> lock(mutex);
+    RegionFile* file = region(key, false);
+    return file == nullptr || file->removeChunk(RegionFile::localCoord(key));
+}
+
+
+bool RegionStore::save(ChunkedTileMap3d &map) {
+    bool success = true;
+    for (glm::ivec3 key : map.getChunkKeys()) {
+        success &= saveChunk(key, map.getChunkCells(key));
+    }
+    return success;
+}
@@ -0,0 +1,99 @@
+#ifndef REGIONFILE_H
+#define REGIONFILE_H
+
+#include <glm/vec3.hpp> // glm::ivec3
+
+#include <stdint.h>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "cellstorage.h"
+#include "chunkedtilemap3d.h"
+#include "mappedfile.h"
+
+
+// File with the chunks of a ChunkedTileMap3d in a region of REGION_SIZE^3 chunks. Every chunk is run-
+// length encoded on its own (CellStorage::encodeRuns), so reading one is a lookup in the header and a
+// decode straight from the memory mapped file, without parsing the rest. A rewritten chunk stays in
+// place while it fits into the space reserved for it, otherwise it moves to the end of the file; the
+// old space is not reused.
+// Layout, little-endian:
+//     "VXRG", uint32 version, uint32 chunk size
+//     REGION_CHUNKS entries of uint64 offset, uint32 size, uint32 capacity, x-major; offset 0 if absent
+//     chunk data at the offsets: uint8 cell type, runs
+class RegionFile {
+    public:
+        static const int REGION_BITS = 4;
+        static const int REGION_SIZE = 1 << REGION_BITS;
+        static const int REGION_CHUNKS = REGION_SIZE * REGION_SIZE * REGION_SIZE;
+
+        RegionFile() {}
+        RegionFile(const RegionFile &other) = delete;
+        RegionFile& operator=(const RegionFile &other) = delete;
+
+        // Creates the file if it does not exist. Returns false if it cannot be created or is not a
+        // region file.
+        bool open(const std::string &path);
+        void close();
+
+        // Chunk coordinates are local to the region, in [0, REGION_SIZE).
+        bool hasChunk(glm::ivec3 local) const {return !table.empty() && table[index(local)].offset != 0;}
+        // False if the chunk is absent or its data is broken.
+        bool readChunk(glm::ivec3 local, CellStorage &cells);
+        bool writeChunk(glm::ivec3 local, const CellStorage &cells);
+        bool removeChunk(glm::ivec3 local);
+
+        static glm::ivec3 regionCoord(glm::ivec3 chunk) {return chunk >> REGION_BITS;}
+        static glm::ivec3 localCoord(glm::ivec3 chunk) {return chunk & (REGION_SIZE - 1);}
+
+    private:
+        struct Entry {
+            uint64_t offset;
+            uint32_t size, capacity;
+        };
+
+        std::string path;
+        MappedFile file;
+        // Opened by the first write and kept until close. The mapping sees data rewritten in place, it
+        // is only renewed to read chunks appended beyond its end.
+        std::fstream out;
+        std::vector<Entry> table;
+        uint64_t fileEnd = 0;
+
+        static int index(glm::ivec3 local) {
+            return (local.x * REGION_SIZE + local.y) * REGION_SIZE + local.z;
+        }
+        bool writeEntry(int i, const std::vector<uint8_t> &data);
+        void error(const std::string &info) const;
+};
+
+
+// World of chunks in region files named r.<x>.<y>.<z>.vxr inside an existing directory. Region files
+// are opened on first use and kept open. Safe to use from several threads, e.g. by the chunk source
+// of a WorldStreamer.
+class RegionStore {
+    public:
+        RegionStore(const std::string &directory);
+
+        // False if the chunk was never saved or cannot be read.
+        bool loadChunk(glm::ivec3 key, CellStorage &cells);
+        bool saveChunk(glm::ivec3 key, const CellStorage &cells);
+        bool removeChunk(glm::ivec3 key);
+        // Saves all chunks of the map. Chunks which are not in the map are left in the files.
+        bool save(ChunkedTileMap3d &map);
+
+    private:
+        std::string directory;
+        std::mutex mutex;
+        std::unordered_map<glm::ivec3, std::unique_ptr<RegionFile>, ChunkKeyHash> regions;
+
+        // Null if the region file cannot be opened, or does not exist and create is false.
+        RegionFile* region(glm::ivec3 key, bool create);
+};
+
+
+#endif // REGIONFILE_H
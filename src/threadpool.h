@@ -0,0 +1,103 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Fixed size pool of worker threads. Jobs must not touch OpenGL, gl calls stay on the main thread.
+class ThreadPool {
+    public:
+        ThreadPool(unsigned int threadCount);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool &other) = delete;
+        ThreadPool& operator=(const ThreadPool &other) = delete;
+
+        unsigned int size() {return workers.size();}
+
+        // Queues f and returns a future for its result.
+        template <class F>
+        auto submit(F f) -> std::future<decltype(f())>;
+
+        // Calls f(i) for every i in [0, count) on the workers and the calling thread and returns once all
+        // calls are finished. May be called from inside a job, the calling thread never waits idle for
+        // queued work.
+        template <class F>
+        void parallelFor(int count, F f);
+
+        // Pool shared by the whole program with one worker less than there are hardware threads.
+        static ThreadPool& shared();
+
+    private:
+        std::vector<std::thread> workers;
+        std::deque<std::function<void()>> jobs;
+        std::mutex mutex;
+        std::condition_variable condition;
+        bool stopping = false;
+
+        void enqueue(std::function<void()> job);
+        void workerLoop();
+};
+
+
+template <class F>
+auto ThreadPool::submit(F f) -> std::future<decltype(f())> {
+    auto task = std::make_shared<std::packaged_task<decltype(f())()>>(f);
+    auto future = task->get_future();
+    if (workers.empty()) {
+        (*task)();
+    } else {
+        enqueue([task]() { (*task)(); });
+    }
+    return future;
+}
+
+
+template <class F>
+void ThreadPool::parallelFor(int count, F f) {
+    if (count <= 0) return;
+
+    // Shared with the helper jobs, which may only start after this call has returned.
+    struct State {
+        F f;
+        int count;
+        std::atomic<int> next {0};
+        std::atomic<int> done {0};
+        std::mutex mutex;
+        std::condition_variable finished;
+        State(F f, int count) : f(f), count(count) {}
+    };
+    auto state = std::make_shared<State>(f, count);
+
+    auto work = [state]() {
+        int i;
+        while ((i = state->next++) < state->count) {
+            state->f(i);
+            if (++state->done == state->count) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->finished.notify_all();
+            }
+        }
+    };
+
+    int helpers = std::min<int>(count - 1, workers.size());
+    for (int i = 0; i < helpers; i++) {
+        enqueue(work);
+    }
+    work();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&state]() { return state->done == state->count; });
+}
+
+
+#endif // THREADPOOL_H
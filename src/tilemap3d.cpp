@@ -1,68 +1,403 @@
 
 
 #include "tilemap3d.h"
+#include "meshcache.h"
+#include "voxelmesher.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 
 
-TileMap3d::TileMap3d(const std::vector<Tile> palette, int xSize, int ySize, int zSize) : \
+
+TileMap3d::TileMap3d(SharedPalette palette, int xSize, int ySize, int zSize, CellType cellType, 
+        CellLayout layout) : \
         xSize(xSize), 
         ySize(ySize), 
         zSize(zSize), 
-        palette(palette)
+        content(Content(glm::ivec3(xSize, ySize, zSize), cellType, layout)),
+        palette(palette),
+        mesh(std::make_shared<SharedMesh>())
 {
-    content.resize(xSize * ySize * zSize);
 }
 
 
-TileMap3d::TileMap3d(const std::vector<Tile> palette, int xSize) : \
-        xSize(xSize), 
-        ySize(xSize), 
-        zSize(xSize), 
-        palette(palette)
+TileMap3d::TileMap3d(SharedPalette palette, int xSize, CellType cellType, CellLayout layout) : \
+        TileMap3d(palette, xSize, xSize, xSize, cellType, layout)
 {
-    content.resize(xSize * ySize * zSize);
-    this->palette = palette;
 }
 
-void TileMap3d::setPalette(const Palette palette) {
+
+TileMap3d::SharedMesh::~SharedMesh() {
+    if (meshID != 0) {
+        Renderer::deleteMesh(meshID);
+    }
+}
+
+void TileMap3d::setPalette(SharedPalette palette) {
     this->palette = palette;
+    meshOutdated = true;
 }
 
-const Palette TileMap3d::getPalette() {
-    return this->palette;
+void TileMap3d::setCellType(CellType cellType) {
+    if (cellType == content->cells.getType()) return;
+    content.write().cells.setType(cellType);
 }
 
-int TileMap3d::index(int x, int y, int z) {
+void TileMap3d::setLayout(CellLayout layout) {
+    if (layout == content->indexer.getLayout()) return;
+    CellIndexer reordered(xSize, ySize, zSize, layout);
+    CellStorage reorderedContent(content->cells.getType(), reordered.cellCount());
+    for (int x = 0; x < xSize; x++) {
+        for (int y = 0; y < ySize; y++) {
+            for (int z = 0; z < zSize; z++) {
+                reorderedContent.set(reordered(x, y, z), getUnchecked(x, y, z));
+            }
+        }
+    }
+    Content &c = content.write();
+    c.indexer = std::move(reordered);
+    c.cells = std::move(reorderedContent);
+}
+
+glm::ivec3 TileMap3d::wrap(int x, int y, int z) {
     x = x % xSize;
     if (x < 0) x += xSize;
     y = y % ySize;
     if (y < 0) y += ySize;
     z = z % zSize;
     if (z < 0) z += zSize;
-    assert(x * ySize * zSize + y * zSize + z < xSize * ySize * zSize);
-    return x * ySize * zSize + y * zSize + z;
+    return glm::ivec3(x, y, z);
+}
+
+int TileMap3d::index(int x, int y, int z) {
+    glm::ivec3 p = wrap(x, y, z);
+    return content->indexer(p.x, p.y, p.z);
 }
 unsigned int TileMap3d::get(int x, int y, int z) {
-    return content[index(x, y, z)];
+    return content->cells.get(index(x, y, z));
 }
 unsigned int TileMap3d::get(glm::ivec3 k) {
     return get(k.x, k.y, k.z);
 }
 
 Tile TileMap3d::getTile(int x, int y, int z) {
-    return palette[get(x, y, z) - 1];
+    return (*palette)[get(x, y, z) - 1];
 }
 
 Tile TileMap3d::getTile(glm::ivec3 k) {
     return getTile(k.x, k.y, k.z);
 }
 
+void TileMap3d::checkValue(unsigned int value) {
+    // Indices are limited by the palette and by the cell type.
+    size_t limit = std::min<size_t>(palette->size(), (size_t)CellStorage::maxValue(content->cells.getType()) + 1);
+    if (value >= limit) {
+        throw std::invalid_argument( "Tile index " + std::to_string(value) + " out of range: 0 - " + std::to_string(limit) );
+    }
+}
+
 void TileMap3d::set(int x, int y, int z, unsigned int value) {
     meshOutdated = true;
-    if (value >= palette.size()) {
-        throw std::invalid_argument( "Tile index " + std::to_string(value) + " out of range: 0 - " + std::to_string(palette.size()) );
+    checkValue(value);
+    glm::ivec3 p = wrap(x, y, z);
+    setUnchecked(p.x, p.y, p.z, value);
+}
+
+void TileMap3d::setUnchecked(int x, int y, int z, unsigned int value) {
+    meshOutdated = true;
+    const uint64_t stampBefore = content.stamp();
+    Content &c = content.write();
+    const int i = c.indexer(x, y, z);
+    const bool changed = (c.cells.get(i) != 0) != (value != 0);
+    c.cells.set(i, value);
+    if (changed) {
+        setSolid(c, glm::ivec3(x, y, z), value != 0);
+    }
+    markDirty(glm::ivec3(x, y, z), value != 0, stampBefore);
+}
+
+void TileMap3d::setSolid(Content &c, glm::ivec3 p, bool solid) {
+    c.brickMap.setSolid(p, solid);
+    c.heightmap.setSolid(p, solid, [&](glm::ivec3 q) {
+        return c.cells.get(c.indexer(q.x, q.y, q.z)) != 0;
+    });
+}
+
+int TileMap3d::groundHeight(int x, int y, int z) const {
+    return content->heightmap.groundHeight(x, y, z, [&](glm::ivec3 p) {
+        return getUnchecked(p.x, p.y, p.z) != 0;
+    });
+}
+
+void TileMap3d::setColumnLayers(bool enabled) {
+    if (enabled == content->heightmap.hasLayers()) return;
+    Content &c = content.write();
+    c.heightmap.setLayers(enabled, [&](glm::ivec3 p) {
+        return c.cells.get(c.indexer(p.x, p.y, p.z)) != 0;
+    });
+}
+
+bool TileMap3d::isEmptyRegion(glm::ivec3 lo, glm::ivec3 hi) const {
+    bool empty = true;
+    content->brickMap.forEachBrick(lo, hi, [&](glm::ivec3 brickLo, glm::ivec3 brickHi) {
+        for (int x = brickLo.x; x < brickHi.x && empty; x++) {
+            for (int y = brickLo.y; y < brickHi.y && empty; y++) {
+                for (int z = brickLo.z; z < brickHi.z && empty; z++) {
+                    empty = getUnchecked(x, y, z) == 0;
+                }
+            }
+        }
+    });
+    return empty;
+}
+
+namespace {
+struct RaycastSource {
+    const TileMap3d* map;
+    glm::ivec3 extent;
+
+    glm::ivec3 size() const {
+        return extent;
+    }
+    unsigned int get(int x, int y, int z) const {
+        return map->getUnchecked(x, y, z);
+    }
+};
+}
+
+RayHit TileMap3d::raycast(const Ray &ray) const {
+    return VoxelRaycast::cast(RaycastSource{this, glm::ivec3(xSize, ySize, zSize)}, content->brickMap, ray);
+}
+
+std::vector<RayHit> TileMap3d::raycastMany(const std::vector<Ray> &rays) const {
+    return VoxelRaycast::castMany(RaycastSource{this, glm::ivec3(xSize, ySize, zSize)}, content->brickMap, rays);
+}
+
+bool TileMap3d::ownsOccupancy(uint64_t stampBefore) {
+    // The occupancy of a shared mesh belongs to the other copies as well, it is rebuilt when needed.
+    return mesh.use_count() == 1 && mesh->occupancy.isBuilt() && mesh->occupancyStamp == stampBefore;
+}
+
+void TileMap3d::markDirty(glm::ivec3 p, bool solid, uint64_t stampBefore) {
+    if (ownsOccupancy(stampBefore)) {
+        mesh->occupancy.set(p.x, p.y, p.z, solid);
+        mesh->occupancyStamp = content.stamp();
+    }
+    growDirtyRegion(p, p, stampBefore);
+}
+
+void TileMap3d::growDirtyRegion(glm::ivec3 lo, glm::ivec3 hi, uint64_t stampBefore) {
+    if (hasDirtyRegion) {
+        dirtyMin = glm::min(dirtyMin, lo);
+        dirtyMax = glm::max(dirtyMax, hi);
+    } else {
+        dirtyMin = lo;
+        dirtyMax = hi;
+        dirtyBase = stampBefore;
+        hasDirtyRegion = true;
+    }
+}
+
+void TileMap3d::markDirtyRegion(Content &c, glm::ivec3 lo, glm::ivec3 hi, uint64_t stampBefore) {
+    meshOutdated = true;
+    auto isSolid = [&](glm::ivec3 p) {
+        return c.cells.get(c.indexer(p.x, p.y, p.z)) != 0;
+    };
+    c.brickMap.recount(lo, hi, isSolid);
+    c.heightmap.refresh(lo, hi, isSolid);
+    if (ownsOccupancy(stampBefore)) {
+        for (int x = lo.x; x < hi.x; x++) {
+            for (int y = lo.y; y < hi.y; y++) {
+                for (int z = lo.z; z < hi.z; z++) {
+                    mesh->occupancy.set(x, y, z, c.cells.get(c.indexer(x, y, z)) != 0);
+                }
+            }
+        }
+        mesh->occupancyStamp = content.stamp();
+    }
+    growDirtyRegion(lo, hi - 1, stampBefore);
+}
+
+
+void TileMap3d::fillRow(Content &c, int x, int y, int zLo, int zHi, unsigned int value) {
+    if (c.indexer.getLayout() == CellLayout::LINEAR) {
+        c.cells.fill(c.indexer(x, y, zLo), zHi - zLo, value);
+    } else {
+        for (int z = zLo; z < zHi; z++) {
+            c.cells.set(c.indexer(x, y, z), value);
+        }
+    }
+}
+
+void TileMap3d::fillBox(glm::ivec3 lo, glm::ivec3 hi, unsigned int value) {
+    checkValue(value);
+    lo = glm::max(lo, glm::ivec3(0));
+    hi = glm::min(hi, glm::ivec3(xSize, ySize, zSize));
+    if (glm::any(glm::greaterThanEqual(lo, hi))) {
+        return;
+    }
+
+    const uint64_t stampBefore = content.stamp();
+    Content &c = content.write();
+    if (c.indexer.getLayout() == CellLayout::LINEAR) {
+        // Rows which follow each other in memory are filled as one span, whole bricks of packed
+        // storage are then collapsed.
+        const size_t rowLength = hi.z - lo.z;
+        size_t spanStart = 0, spanLength = 0;
+        for (int x = lo.x; x < hi.x; x++) {
+            for (int y = lo.y; y < hi.y; y++) {
+                const size_t start = c.indexer(x, y, lo.z);
+                if (spanLength > 0 && start == spanStart + spanLength) {
+                    spanLength += rowLength;
+                    continue;
+                }
+                if (spanLength > 0) {
+                    c.cells.fill(spanStart, spanLength, value);
+                }
+                spanStart = start;
+                spanLength = rowLength;
+            }
+        }
+        c.cells.fill(spanStart, spanLength, value);
+    } else {
+        for (int x = lo.x; x < hi.x; x++) {
+            for (int y = lo.y; y < hi.y; y++) {
+                fillRow(c, x, y, lo.z, hi.z, value);
+            }
+        }
+    }
+
+    meshOutdated = true;
+    const bool solid = value != 0;
+    auto isSolid = [&](glm::ivec3 p) {
+        return c.cells.get(c.indexer(p.x, p.y, p.z)) != 0;
+    };
+    c.brickMap.fill(lo, hi, solid, isSolid);
+    c.heightmap.refresh(lo, hi, isSolid);
+    if (ownsOccupancy(stampBefore)) {
+        for (int x = lo.x; x < hi.x; x++) {
+            for (int y = lo.y; y < hi.y; y++) {
+                for (int z = lo.z; z < hi.z; z++) {
+                    mesh->occupancy.set(x, y, z, solid);
+                }
+            }
+        }
+        mesh->occupancyStamp = content.stamp();
+    }
+    growDirtyRegion(lo, hi - 1, stampBefore);
+}
+
+void TileMap3d::fillSphere(glm::vec3 center, float radius, unsigned int value) {
+    checkValue(value);
+    const glm::ivec3 lo = glm::max(glm::ivec3(glm::floor(center - radius)), glm::ivec3(0));
+    const glm::ivec3 hi = glm::min(glm::ivec3(glm::floor(center + radius)) + 1, glm::ivec3(xSize, ySize, zSize));
+    if (radius < 0.0f || glm::any(glm::greaterThanEqual(lo, hi))) {
+        return;
     }
-    content[index(x, y, z)] = value;
+
+    const uint64_t stampBefore = content.stamp();
+    Content &c = content.write();
+    for (int x = lo.x; x < hi.x; x++) {
+        for (int y = lo.y; y < hi.y; y++) {
+            // Cell centers of the row inside the sphere lie within dz of the center.
+            float dx = x + 0.5f - center.x;
+            float dy = y + 0.5f - center.y;
+            float rest = radius * radius - dx * dx - dy * dy;
+            if (rest < 0.0f) continue;
+            float dz = std::sqrt(rest);
+            int zLo = std::max(lo.z, (int)std::ceil(center.z - dz - 0.5f));
+            int zHi = std::min(hi.z, (int)std::floor(center.z + dz - 0.5f) + 1);
+            if (zLo < zHi) {
+                fillRow(c, x, y, zLo, zHi, value);
+            }
+        }
+    }
+    markDirtyRegion(c, lo, hi, stampBefore);
+}
+
+void TileMap3d::setMany(const std::vector<CellEdit> &edits) {
+    if (edits.empty()) {
+        return;
+    }
+    unsigned int maxValue = 0;
+    for (const CellEdit &edit : edits) {
+        maxValue = std::max(maxValue, edit.value);
+    }
+    checkValue(maxValue);
+
+    meshOutdated = true;
+    const uint64_t stampBefore = content.stamp();
+    const bool updateOccupancy = ownsOccupancy(stampBefore);
+    Content &c = content.write();
+    glm::ivec3 lo = wrap(edits[0].position.x, edits[0].position.y, edits[0].position.z);
+    glm::ivec3 hi = lo;
+    for (const CellEdit &edit : edits) {
+        const glm::ivec3 p = wrap(edit.position.x, edit.position.y, edit.position.z);
+        const int i = c.indexer(p.x, p.y, p.z);
+        const bool solid = edit.value != 0;
+        const bool changed = (c.cells.get(i) != 0) != solid;
+        c.cells.set(i, edit.value);
+        if (changed) {
+            setSolid(c, p, solid);
+        }
+        if (updateOccupancy) {
+            mesh->occupancy.set(p.x, p.y, p.z, solid);
+        }
+        lo = glm::min(lo, p);
+        hi = glm::max(hi, p);
+    }
+    if (updateOccupancy) {
+        mesh->occupancyStamp = content.stamp();
+    }
+    growDirtyRegion(lo, hi, stampBefore);
+}
+
+void TileMap3d::copyRegion(const TileMap3d &source, glm::ivec3 lo, glm::ivec3 hi, glm::ivec3 destination) {
+    // Clip against both maps.
+    const glm::ivec3 shift = destination - lo;
+    lo = glm::max(glm::max(lo, glm::ivec3(0)), -shift);
+    hi = glm::min(glm::min(hi, glm::ivec3(source.xSize, source.ySize, source.zSize)), glm::ivec3(xSize, ySize, zSize) - shift);
+    if (glm::any(glm::greaterThanEqual(lo, hi))) {
+        return;
+    }
+
+    // Read everything first, the source may be this map.
+    const glm::ivec3 extent = hi - lo;
+    std::vector<unsigned int> buffer((size_t)extent.x * extent.y * extent.z);
+    const Content &from = *source.content;
+    unsigned int* row = buffer.data();
+    for (int x = lo.x; x < hi.x; x++) {
+        for (int y = lo.y; y < hi.y; y++) {
+            if (from.indexer.getLayout() == CellLayout::LINEAR) {
+                from.cells.read(from.indexer(x, y, lo.z), extent.z, row);
+            } else {
+                for (int z = lo.z; z < hi.z; z++) {
+                    row[z - lo.z] = from.cells.get(from.indexer(x, y, z));
+                }
+            }
+            row += extent.z;
+        }
+    }
+    checkValue(*std::max_element(buffer.begin(), buffer.end()));
+
+    const uint64_t stampBefore = content.stamp();
+    Content &c = content.write();
+    row = buffer.data();
+    for (int x = lo.x + shift.x; x < hi.x + shift.x; x++) {
+        for (int y = lo.y + shift.y; y < hi.y + shift.y; y++) {
+            const int zLo = lo.z + shift.z;
+            if (c.indexer.getLayout() == CellLayout::LINEAR) {
+                c.cells.write(c.indexer(x, y, zLo), extent.z, row);
+            } else {
+                for (int z = 0; z < extent.z; z++) {
+                    c.cells.set(c.indexer(x, y, zLo + z), row[z]);
+                }
+            }
+            row += extent.z;
+        }
+    }
+    markDirtyRegion(c, lo + shift, hi + shift, stampBefore);
 }
 
 void TileMap3d::set(glm::ivec3 k, unsigned int v) {
@@ -70,136 +405,342 @@ void TileMap3d::set(glm::ivec3 k, unsigned int v) {
 }
 
 
+namespace {
+// Slot for a segment, with room to grow by an eighth and a few quads: a single voxel adds up to six
+// quads to a NAIVE segment, GREEDY segments are slices and mostly change by a quad or two. Empty
+// segments get no room until they get faces.
+TileMap3d::MeshSegment segmentSlot(unsigned int vertexCount, unsigned int indexCount, MeshingMode mode) {
+    if (indexCount == 0) {
+        return {vertexCount, 0, vertexCount, 0};
+    }
+    const unsigned int extraQuads = indexCount / 6 / 8 + (mode == MeshingMode::NAIVE ? 6 : 3);
+    return {vertexCount, indexCount, vertexCount + 4 * extraQuads, indexCount + 6 * extraQuads};
+}
+
+// Fills a segment up to the size of its slot. The unused vertices are zero, the unused indices form
+// degenerate triangles on the first vertex of the slot.
+void padSegment(VoxelMesher::MeshBuffer &segment, const TileMap3d::MeshSegment &slot) {
+    if (segment.packed) {
+        segment.packedVertices.resize(slot.vertexCapacity, Renderer::PackedVertex{});
+    } else {
+        segment.vertices.resize(slot.vertexCapacity, Renderer::Vertex{glm::vec3(0.0f), glm::vec3(0.0f), glm::vec4(0.0f)});
+    }
+    segment.indices.resize(slot.indexCapacity, 0);
+}
+
+
+// Voxel source for the mesher. Faces on the map boundary are visible if showBoundaries is set.
+struct TileMapSource {
+    TileMap3d* map;
+
+    glm::ivec3 size() const {
+        return glm::ivec3(map->getXSize(), map->getYSize(), map->getZSize());
+    }
+    unsigned int get(int x, int y, int z) const {
+        return map->getUnchecked(x, y, z);
+    }
+    bool isEmpty(int x, int y, int z) const {
+        if (x < 0 || y < 0 || z < 0 || x >= map->getXSize() || y >= map->getYSize() || z >= map->getZSize()) {
+            return map->showBoundaries;
+        }
+        return map->getUnchecked(x, y, z) == 0;
+    }
+};
+}
+
+
 void TileMap3d::updateMesh()
 {
     if (!meshOutdated) {
         return;
     }
-    std::vector<Renderer::Vertex> vertices;
-    std::vector <unsigned int> indices;
-    unsigned int index = 0;
 
-    //    v6----- v5
-	//   /|      /|
-	//  v1------v0|
-	//  | |     | |
-	//  | v7----|-v4
-	//  |/      |/
-	//  v2------v3
+    if (mesh->pending) {
+        submitMesh(*mesh->pending);
+        mesh->pending.reset();
+    } else if (mesh->cached) {
+        submitMesh(*mesh->cached);
+        mesh->cached.reset();
+    }
+
+    // Otherwise a copy with the same content has already built the mesh.
+    if (!meshUpToDate()) {
+        // Copies sharing the mesh keep it, this map gets its own.
+        if (mesh.use_count() > 1) {
+            mesh = std::make_shared<SharedMesh>();
+        }
+
+        bool segmentsValid = mesh->meshID != 0 
+            && hasDirtyRegion
+            && mesh->contentStamp == dirtyBase
+            && mesh->paletteStamp == palette.stamp()
+            && meshOptionsMatch()
+            && (int)mesh->segments.size() == VoxelMesher::segmentCount(glm::ivec3(xSize, ySize, zSize), meshingMode);
+
+        if (segmentsValid) {
+            patchMesh();
+        } else {
+            rebuildMesh();
+        }
+        mesh->contentStamp = content.stamp();
+        mesh->paletteStamp = palette.stamp();
+    }
+
+    meshID = mesh->meshID;
+    hasDirtyRegion = false;
+    meshOutdated = false;
+}
+
 
+void TileMap3d::prepareMesh(MeshCache* cache)
+{
+    if (!meshOutdated || mesh->pending || mesh->cached || meshUpToDate()) {
+        return;
+    }
+    if (mesh.use_count() > 1) {
+        mesh = std::make_shared<SharedMesh>();
+    }
+    const uint64_t hash = cache != nullptr ? meshHash() : 0;
+    const int segmentCount = VoxelMesher::segmentCount(glm::ivec3(xSize, ySize, zSize), meshingMode);
+    std::unique_ptr<CachedMesh> cached(cache != nullptr ? new CachedMesh() : nullptr);
+    if (cache != nullptr && cache->load(hash, segmentCount, *cached, mesh->segments)) {
+        // The occupancy is built by the first patch.
+        mesh->mode = meshingMode;
+        mesh->centered = makeMeshCentered;
+        mesh->boundaries = showBoundaries;
+        mesh->packed = cached->packed;
+        mesh->slotted = false;
+        mesh->cached = std::move(cached);
+    } else {
+        mesh->pending.reset(new VoxelMesher::MeshBuffer());
+        buildMesh(*mesh->pending);
+        if (cache != nullptr) {
+            cache->store(hash, *mesh->pending, mesh->segments);
+        }
+    }
+    mesh->contentStamp = content.stamp();
+    mesh->paletteStamp = palette.stamp();
+}
 
+
+namespace {
+// Adds a 64 bit word to a hash, as in the rounds of xxHash64.
+uint64_t hashWord(uint64_t hash, uint64_t word) {
+    const uint64_t PRIME1 = 0x9e3779b185ebca87ULL, PRIME2 = 0xc2b2ae3d27d4eb4fULL;
+    hash ^= word * PRIME2;
+    hash = (hash << 31) | (hash >> 33);
+    return hash * PRIME1;
+}
+}
+
+
+uint64_t TileMap3d::meshHash() {
+    uint64_t hash = hashWord(0, xSize);
+    hash = hashWord(hash, ySize);
+    hash = hashWord(hash, zSize);
+    hash = hashWord(hash, (uint64_t)meshingMode << 3 | makeMeshCentered << 2 | showBoundaries << 1 | usePackedVertices());
+    for (const Tile &tile : *palette) {
+        uint32_t color[4];
+        std::memcpy(color, &tile.color, sizeof(color));
+        hash = hashWord(hash, (uint64_t)color[0] << 32 | color[1]);
+        hash = hashWord(hash, (uint64_t)color[2] << 32 | color[3]);
+    }
+    // Four independent lanes over the cells, which do not wait for each other's multiplications.
+    uint64_t lanes[4] = {hash, hash + 1, hash + 2, hash + 3};
+    std::vector<unsigned int> row(zSize);
     for (int x = 0; x < xSize; x++) {
         for (int y = 0; y < ySize; y++) {
-            for (int z = 0; z < zSize; z++) {
-                int tileState = get(x, y, z);
-                if (tileState != 0) {
-
-                    glm::vec4 color = palette[tileState].color;
-                    glm::vec3 normal, tangent, bitangent;
-                    glm::vec3 center = {x + 0.5, y + 0.5, z + 0.5};
-
-                    auto add_face = [&](glm::vec3 normal, glm::vec3 tangent, glm::vec3 bitangent) { 
-                        Renderer::Vertex v0 = {
-                            center + 0.5f * normal + 0.5f * tangent + 0.5f * bitangent, normal, color
-                        };
-                        Renderer::Vertex v1 = {
-                            center + 0.5f * normal - 0.5f * tangent + 0.5f * bitangent, normal, color
-                        };
-                        Renderer::Vertex v2 = {
-                            center + 0.5f * normal - 0.5f * tangent - 0.5f * bitangent, normal, color
-                        };
-                        Renderer::Vertex v3 = {
-                            center + 0.5f * normal + 0.5f * tangent - 0.5f * bitangent, normal, color
-                        };
-
-                        if (makeMeshCentered) {
-                            v0.position -= this->center();
-                            v1.position -= this->center();
-                            v2.position -= this->center();
-                            v3.position -= this->center();
-                        }
-
-                        vertices.push_back(v0);
-                        vertices.push_back(v1);
-                        vertices.push_back(v2);
-                        vertices.push_back(v3);
-
-                        //if (glm::dot(glm::cross(v0.position - v1.position, v0.position - v2.position), normal) >= 0.0) {
-                        indices.push_back(index);
-                        indices.push_back(index + 1);
-                        indices.push_back(index + 2);
-
-                        indices.push_back(index);
-                        indices.push_back(index + 2);
-                        indices.push_back(index + 3);
-                        /*} else {
-                            std::cout << "B" << std::endl;
-                            indices.push_back(index);
-                            indices.push_back(index + 2);
-                            indices.push_back(index + 1);
-
-                            indices.push_back(index);
-                            indices.push_back(index + 3);
-                            indices.push_back(index + 2);
-                        }*/
-
-                        index += 4;
-                    };
-
-                    if ((x + 1 < xSize && get(x+1, y, z) == 0) || (x + 1 == xSize && showBoundaries)) {
-                        normal = {1, 0, 0};
-                        tangent = {0, 1, 0};
-                        bitangent = {0, 0, 1};
-                        add_face(normal, tangent, bitangent);
-                    }
-
-                    if ((x - 1 >= 0 && get(x-1, y, z) == 0) || (x == 0 && showBoundaries)) {
-                        normal = {-1, 0, 0};
-                        tangent = {0, -1, 0};
-                        bitangent = {0, 0, 1};
-                        add_face(normal, tangent, bitangent);
-                    }
-                    if ((y + 1 < ySize && get(x, y+1, z) == 0) || (y + 1 == ySize && showBoundaries)) {
-                        normal = {0, 1, 0};
-                        tangent = {0, 0, 1};
-                        bitangent = {1, 0, 0};
-                        add_face(normal, tangent, bitangent);
-                    }
-                    if ((y - 1 >= 0 && get(x, y-1, z) == 0) || (y == 0 && showBoundaries)) {
-                        normal = {0, -1, 0};
-                        tangent = {0, 0, -1};
-                        bitangent = {1, 0, 0};
-                        add_face(normal, tangent, bitangent);
-                    }
-                    if ((z + 1 < zSize && get(x, y, z+1) == 0) || (z + 1 == zSize && showBoundaries)) {
-                        normal = {0, 0, 1};
-                        tangent = {1, 0, 0};
-                        bitangent = {0, 1, 0};
-                        add_face(normal, tangent, bitangent);
-                    }
-                    if ((z - 1 >= 0 && get(x, y, z-1) == 0) || (z == 0 && showBoundaries)) {
-                        normal = {0, 0, -1};
-                        tangent = {-1, 0, 0};
-                        bitangent = {0, 1, 0};
-                        add_face(normal, tangent, bitangent);
-                    }
+            if (content->indexer.getLayout() == CellLayout::LINEAR) {
+                content->cells.read(content->indexer(x, y, 0), zSize, row.data());
+            } else {
+                for (int z = 0; z < zSize; z++) {
+                    row[z] = getUnchecked(x, y, z);
                 }
             }
+            int z = 0;
+            for (; z + 4 <= zSize; z += 4) {
+                for (int i = 0; i < 4; i++) {
+                    lanes[i] = hashWord(lanes[i], row[z + i]);
+                }
+            }
+            for (; z < zSize; z++) {
+                lanes[0] = hashWord(lanes[0], row[z]);
+            }
         }
     }
+    for (int i = 0; i < 4; i++) {
+        hash = hashWord(hash, lanes[i]);
+    }
+    return hash;
+}
+
+
+bool TileMap3d::meshUpToDate() {
+    return mesh->meshID != 0
+        && mesh->contentStamp == content.stamp()
+        && mesh->paletteStamp == palette.stamp()
+        && meshOptionsMatch();
+}
+
 
-    // TODO
-    std::cout << "Mesh created with " << vertices.size() << " vertices, " << indices.size() << " indices." << std::endl;
+bool TileMap3d::usePackedVertices() {
+    return packedVertices && VoxelMesher::canPack(*palette, glm::ivec3(xSize, ySize, zSize));
+}
+
+
+bool TileMap3d::meshOptionsMatch() {
+    return mesh->mode == meshingMode
+        && mesh->centered == makeMeshCentered
+        && mesh->boundaries == showBoundaries
+        && mesh->packed == usePackedVertices();
+}
+
+
+void TileMap3d::rebuildMesh()
+{
+    VoxelMesher::MeshBuffer buffer;
+    buildMesh(buffer);
+    submitMesh(buffer);
+}
+
+
+void TileMap3d::buildMesh(VoxelMesher::MeshBuffer &buffer)
+{
+    const glm::ivec3 size(xSize, ySize, zSize);
+    const glm::vec3 offset = makeMeshCentered ? center() : glm::vec3(0.0f);
+    const int count = VoxelMesher::segmentCount(size, meshingMode);
+
+    const bool packed = usePackedVertices();
+
+    // The border of the occupancy depends on showBoundaries.
+    mesh->occupancy.build(TileMapSource{this}, &content->brickMap);
+    mesh->occupancyStamp = content.stamp();
+    std::vector<VoxelMesher::MeshBuffer> segments = VoxelMesher::generateSegmentsParallel(
+        TileMapSource{this}, meshingMode, 0, count, *palette, offset, packed, &mesh->occupancy);
+    mesh->segments.resize(count);
+    for (int i = 0; i < count; i++) {
+        const unsigned int vertexCount = segments[i].vertexCount(), indexCount = segments[i].indices.size();
+        mesh->segments[i] = {vertexCount, indexCount, vertexCount, indexCount};
+    }
+    mesh->slotted = false;
+    buffer.packed = packed;
+    VoxelMesher::concatenate(segments, buffer);
+    mesh->mode = meshingMode;
+    mesh->centered = makeMeshCentered;
+    mesh->boundaries = showBoundaries;
+    mesh->packed = packed;
+}
 
 
-    if (meshID == 0) {
-        meshID = Renderer::newMesh(vertices, indices);
+void TileMap3d::submitMesh(VoxelMesher::MeshBuffer &buffer)
+{
+    std::cout << "Mesh created with " << buffer.vertexCount() << " vertices, " << buffer.indices.size() << " indices." << std::endl;
+
+    if (buffer.packed) {
+        std::vector<glm::vec4> colors = VoxelMesher::packedPalette(*palette);
+        if (mesh->meshID == 0) {
+            mesh->meshID = Renderer::newMesh(buffer.packedVertices, buffer.indices, colors);
+        } else {
+            Renderer::updateMesh(mesh->meshID, buffer.packedVertices, buffer.indices, colors);
+        }
+    } else if (mesh->meshID == 0) {
+        mesh->meshID = Renderer::newMesh(buffer.vertices, buffer.indices);
     } else {
-        Renderer::updateMesh(meshID, vertices, indices);
+        Renderer::updateMesh(mesh->meshID, buffer.vertices, buffer.indices);
     }
+}
 
-    meshOutdated = false;
 
+void TileMap3d::submitMesh(const CachedMesh &cached)
+{
+    if (cached.packed) {
+        std::vector<glm::vec4> colors = VoxelMesher::packedPalette(*palette);
+        if (mesh->meshID == 0) {
+            mesh->meshID = Renderer::newMesh(cached.packedVertices, cached.vertexCount, cached.indices, cached.indexCount, colors);
+        } else {
+            Renderer::updateMesh(mesh->meshID, cached.packedVertices, cached.vertexCount, cached.indices, cached.indexCount, colors);
+        }
+    } else if (mesh->meshID == 0) {
+        mesh->meshID = Renderer::newMesh(cached.vertices, cached.vertexCount, cached.indices, cached.indexCount);
+    } else {
+        Renderer::updateMesh(mesh->meshID, cached.vertices, cached.vertexCount, cached.indices, cached.indexCount);
+    }
+}
+
+
+void TileMap3d::patchMesh()
+{
+    const glm::ivec3 size(xSize, ySize, zSize);
+    const glm::vec3 offset = makeMeshCentered ? center() : glm::vec3(0.0f);
+    std::vector<int> segments = VoxelMesher::segmentsAround(size, meshingMode, dirtyMin, dirtyMax);
+    std::vector<MeshSegment> &meshSegments = mesh->segments;
+
+    // Meshes are built and cached without spare room, it is added once they get edited.
+    if (!mesh->slotted) {
+        for (MeshSegment &segment : meshSegments) {
+            segment = segmentSlot(segment.vertexCount, segment.indexCount, meshingMode);
+        }
+        Renderer::spreadMesh(mesh->meshID, meshSegments);
+        mesh->slotted = true;
+    }
+
+    // Changes made while the mesh was shared did not reach the occupancy.
+    if (mesh->occupancyStamp != content.stamp()) {
+        mesh->occupancy.build(TileMapSource{this}, &content->brickMap);
+        mesh->occupancyStamp = content.stamp();
+    }
+
+    // Patch runs of consecutive segments from back to front, so the start of the remaining runs does not move.
+    int runEnd = segments.size();
+    while (runEnd > 0) {
+        int runStart = runEnd - 1;
+        while (runStart > 0 && segments[runStart - 1] + 1 == segments[runStart]) {
+            runStart--;
+        }
+        int first = segments[runStart];
+        int last = segments[runEnd - 1];
+
+        unsigned int vertexStart = 0, indexStart = 0;
+        for (int i = 0; i < first; i++) {
+            vertexStart += meshSegments[i].vertexCapacity;
+            indexStart += meshSegments[i].indexCapacity;
+        }
+
+        // Segments which still fit into their slots replace only the slots, so the mesh behind them
+        // stays in place and only the slots are uploaded.
+        unsigned int oldVertexCount = 0, oldIndexCount = 0;
+        std::vector<VoxelMesher::MeshBuffer> parts(last - first + 1);
+        for (int i = first; i <= last; i++) {
+            MeshSegment &slot = meshSegments[i];
+            oldVertexCount += slot.vertexCapacity;
+            oldIndexCount += slot.indexCapacity;
+
+            VoxelMesher::MeshBuffer &part = parts[i - first];
+            part.packed = mesh->packed;
+            VoxelMesher::generateSegment(TileMapSource{this}, meshingMode, i, *palette, offset, part, &mesh->occupancy);
+            if (part.vertexCount() <= slot.vertexCapacity && part.indices.size() <= slot.indexCapacity) {
+                slot.vertexCount = part.vertexCount();
+                slot.indexCount = part.indices.size();
+            } else {
+                // Slots grow at least twofold, so a segment which keeps growing rarely moves the mesh.
+                MeshSegment grown = segmentSlot(part.vertexCount(), part.indices.size(), meshingMode);
+                grown.vertexCapacity = std::max(grown.vertexCapacity, 2 * slot.vertexCapacity);
+                grown.indexCapacity = std::max(grown.indexCapacity, 2 * slot.indexCapacity);
+                slot = grown;
+            }
+            padSegment(part, slot);
+        }
+        VoxelMesher::MeshBuffer buffer;
+        buffer.packed = mesh->packed;
+        VoxelMesher::concatenate(parts, buffer);
+
+        if (buffer.packed) {
+            Renderer::patchMesh(mesh->meshID, vertexStart, oldVertexCount, buffer.packedVertices, indexStart, oldIndexCount, buffer.indices);
+        } else {
+            Renderer::patchMesh(mesh->meshID, vertexStart, oldVertexCount, buffer.vertices, indexStart, oldIndexCount, buffer.indices);
+        }
+        runEnd = runStart;
+    }
 }
 
 
@@ -220,17 +761,21 @@ glm::vec3 TileMap3d::center() {
 
 TileMap3d* createPaletteTileMap(std::vector<Tile> palette, int spacing, int width=-1) {
     int s = spacing + 1;
+    std::vector<CellEdit> edits;
+    edits.reserve(palette.size());
     if (width > 0) {
         TileMap3d* ret = new TileMap3d(palette, width, (palette.size() * s) / width + 1, 1);
         for (unsigned int i = 0; i < palette.size(); i++) {
-            ret->set( (i * s) % width, (i*s) / width, 0, i );
+            edits.push_back({glm::ivec3((i * s) % width, (i*s) / width, 0), i});
         }
+        ret->setMany(edits);
         return ret;
     } else {
         TileMap3d* ret = new TileMap3d(palette, palette.size() * (s), 1, 1);
         for (unsigned int i = 0; i < palette.size(); i++) {
-            ret->set(i * s, 0, 0, i);
+            edits.push_back({glm::ivec3(i * s, 0, 0), i});
         }
+        ret->setMany(edits);
         return ret;
     }
 }
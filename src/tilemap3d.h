@@ -9,69 +9,341 @@
 #include <glm/gtc/matrix_transform.hpp> // glm::translate, glm::rotate, glm::scale, glm::perspective
 #include <glm/gtc/type_ptr.hpp>  // glm::value_ptr()
 
+#include <algorithm>
+#include <limits>
 #include <stdexcept>
 #include <memory>
 
 #include "shader.h"
+#include "brickmap.h"
+#include "cellstorage.h"
+#include "cowptr.h"
+#include "heightmap.h"
+#include "raycast.h"
 #include "mesh.h"
+#include "occupancy.h"
 #include "rendercomponent.h"
 #include "assert.h"
 #include <vector>
 #include "utils.h"
 
 
+namespace VoxelMesher {
+struct MeshBuffer;
+}
+class MeshCache;
+struct CachedMesh;
+
+
 struct Tile {
     glm::vec4 color;
 };
 
 typedef std::vector<Tile> Palette;
+// Palette shared between tilemaps until one of them changes it.
+typedef CowPtr<Palette> SharedPalette;
+
+
+struct CellEdit {
+    glm::ivec3 position;
+    unsigned int value;
+};
+
+
+enum class MeshingMode {
+    NAIVE,  // one quad per exposed voxel face
+    GREEDY  // coplanar faces with equal palette index are merged into maximal rectangles
+};
 
 // tile palette at index 0 is reserved. palette value at 0 must be set but is ignored for mesh generation.
+// Copies of a tilemap share content, palette and mesh until they are changed, copying only costs a
+// few reference counts.
 class TileMap3d {
     public:
         Renderer::MeshID meshID = 0;
         bool meshOutdated = true;
         bool makeMeshCentered = true;
         bool showBoundaries = true;
+        MeshingMode meshingMode = MeshingMode::NAIVE;
+        // Generate meshes with Renderer::PackedVertex. Ignored if the palette has more than 256 entries.
+        bool packedVertices = false;
 
         //TileMap3d() : xSize(0), ySize(0), zSize(0), content(0) {};
-        TileMap3d(const Palette palette, int xSize, int ySize, int zSize);
-        TileMap3d(const Palette palette, int xSize);
+        TileMap3d(SharedPalette palette, int xSize, int ySize, int zSize, CellType cellType = CellType::UINT32, 
+            CellLayout layout = CellLayout::LINEAR);
+        TileMap3d(SharedPalette palette, int xSize, CellType cellType = CellType::UINT32, 
+            CellLayout layout = CellLayout::LINEAR);
 
         // TileMap3d(const TileMap3d &other);
 
-        void setPalette(const Palette palette);
-        const Palette getPalette();
+        void setPalette(SharedPalette palette);
+        const Palette& getPalette() const {return *palette;}
+        SharedPalette getSharedPalette() const {return palette;}
+
+        // Width of the stored palette indices. Changing it converts the content and throws if an index
+        // does not fit into the new type.
+        CellType getCellType() {return content->cells.getType();}
+        void setCellType(CellType cellType);
+        size_t memoryUsage() {return content->cells.memoryUsage();}
+
+        // Order of the cells in memory. Changing it reorders the content.
+        CellLayout getLayout() {return content->indexer.getLayout();}
+        void setLayout(CellLayout layout);
         
+        // Coordinates wrap around the map.
         int index(int x, int y, int z);
         unsigned int get(int x, int y, int z);
         unsigned int get(glm::ivec3 k);
 
+        // Unchecked access for hot loops. Coordinates must lie inside the map and, for set, value must
+        // be a valid palette index.
+        int indexUnchecked(int x, int y, int z) const {return content->indexer(x, y, z);}
+        unsigned int getUnchecked(int x, int y, int z) const {return content->cells.get(content->indexer(x, y, z));}
+        void setUnchecked(int x, int y, int z, unsigned int value);
+
+        // Calls f(glm::ivec3 position, unsigned int value) for all non-empty cells in [lo, hi) without
+        // wrapping. Empty bricks are skipped.
+        template <class F>
+        void forEachInBox(glm::ivec3 lo, glm::ivec3 hi, F f) const;
+        bool isEmptyRegion(glm::ivec3 lo, glm::ivec3 hi) const;
+
+        // Occupancy hierarchy of the content, kept up to date by set.
+        const BrickMap& getBrickMap() const {return content->brickMap;}
+
+        // Column heightmap with z pointing up, kept up to date by set and the bulk edits. Coordinates
+        // must lie inside the map.
+        const ColumnHeightmap& getHeightmap() const {return content->heightmap;}
+        // Height of the top non-empty cell of column (x, y) plus one, 0 if the column is empty.
+        int surfaceHeight(int x, int y) const {return content->heightmap.surfaceHeight(x, y);}
+        // Top of the highest non-empty cell of the column below z plus one, 0 if there is none.
+        int groundHeight(int x, int y, int z) const;
+        // Also keeps the runs of non-empty cells of every column, which makes groundHeight O(runs) and
+        // lets overhangs be queried through getHeightmap().getLayers.
+        void setColumnLayers(bool enabled);
+
+        // First non-empty voxel along the ray. Rays are in voxel coordinates of the map, voxel (x, y, z)
+        // covers [x, x + 1) on every axis; the mesh offset of makeMeshCentered is not applied.
+        RayHit raycast(const Ray &ray) const;
+        // Casts the rays in parallel. The map must not be changed meanwhile.
+        std::vector<RayHit> raycastMany(const std::vector<Ray> &rays) const;
+
         Tile getTile(int x, int y, int z);
         Tile getTile(glm::ivec3 k);
 
         void set(int x, int y, int z, unsigned int value);
         void set(glm::ivec3 k, unsigned int v);
 
+        // Bulk edits. The values are checked once, rows of cells are written as spans (in the linear
+        // layout) and the changes are marked as one dirty region. Boxes are [lo, hi) and are clipped to
+        // the map instead of wrapping.
+        void fillBox(glm::ivec3 lo, glm::ivec3 hi, unsigned int value);
+        // Cells whose center lies inside the sphere.
+        void fillSphere(glm::vec3 center, float radius, unsigned int value);
+        // Positions wrap as in set. Throws before changing anything if a value is out of range.
+        void setMany(const std::vector<CellEdit> &edits);
+        // Writes voxel records, e.g. the XYZI chunk of a .vox file, straight into the cell array and the
+        // occupancy data in one pass. Record needs x, y, z and colorIndex members. The values are checked
+        // once up front, positions wrap as in set.
+        template <class Record>
+        void importVoxels(const Record* records, size_t count);
+        // Copies the cells of source in [lo, hi), including empty ones, to the box starting at destination.
+        // The source may be this map, also with overlapping boxes.
+        void copyRegion(const TileMap3d &source, glm::ivec3 lo, glm::ivec3 hi, glm::ivec3 destination);
+
+        // Regenerates the mesh if it is outdated. Changes made through set only regenerate the affected
+        // part of the mesh, a full rebuild happens if the meshing options or the palette changed.
+        // Copies with the same content, palette and options use the same mesh.
         void updateMesh();
+        // Generates an outdated mesh completely without passing it to the Renderer, which is not thread
+        // safe; the next updateMesh only hands it over. For meshing on worker threads, the map must not
+        // be used elsewhere meanwhile. With a cache, a mesh stored under the same meshHash is used
+        // instead of meshing, and new meshes are stored.
+        void prepareMesh(MeshCache* cache = nullptr);
+        // Hash of everything the mesh depends on: size, cells, palette and meshing options. Independent of
+        // the cell type and layout.
+        uint64_t meshHash();
+
+        // Vertex and index count of every segment of a mesh and the size of its slot in the mesh. Slots
+        // are as large as their segments until the mesh is patched for the first time.
+        typedef Renderer::MeshSlot MeshSegment;
 
         glm::vec3 center();
 
-        int getXSize() {return xSize;}
-        int getYSize() {return ySize;};
-        int getZSize() {return zSize;};
+        int getXSize() const {return xSize;}
+        int getYSize() const {return ySize;}
+        int getZSize() const {return zSize;}
 
 
     private:
         int xSize;
         int ySize;
         int zSize;
-        std::vector<int> content;
-    public:
-        Palette palette;
+
+        struct Content {
+            CellIndexer indexer;
+            CellStorage cells;
+            BrickMap brickMap;
+            ColumnHeightmap heightmap;
+            Content(glm::ivec3 size, CellType cellType, CellLayout layout) :
+                indexer(size.x, size.y, size.z, layout), cells(cellType, indexer.cellCount()), brickMap(size),
+                heightmap(size) {}
+        };
+        CowPtr<Content> content;
+        SharedPalette palette;
+
+        // Voxel region changed since the last mesh update. Only the mesh segments around it
+        // are regenerated and patched into the existing mesh. dirtyBase is the content stamp
+        // before the first change.
+        bool hasDirtyRegion = false;
+        glm::ivec3 dirtyMin, dirtyMax;
+        uint64_t dirtyBase = 0;
+
+        // Mesh with the content and palette stamps and the options it was generated with. Copies
+        // share it; a copy which needs a different mesh gets a new one instead of changing this one.
+        // Deletes its Renderer mesh when the last copy of the tilemap using it goes away.
+        struct SharedMesh {
+            ~SharedMesh();
+
+            Renderer::MeshID meshID = 0;
+            uint64_t contentStamp = 0, paletteStamp = 0;
+            MeshingMode mode;
+            bool centered, boundaries, packed;
+            std::vector<MeshSegment> segments;
+            // Whether the slots have room to grow, set by the first patch.
+            bool slotted = false;
+            // Solid voxels for the mesher, kept up to date by set while the mesh is not shared.
+            OccupancyMask occupancy;
+            uint64_t occupancyStamp = 0;
+            // Generated or found in the cache by prepareMesh and not yet passed to the Renderer.
+            std::unique_ptr<VoxelMesher::MeshBuffer> pending;
+            std::unique_ptr<CachedMesh> cached;
+        };
+        std::shared_ptr<SharedMesh> mesh;
+
+        bool usePackedVertices();
+        bool meshOptionsMatch();
+        bool meshUpToDate();
+        glm::ivec3 wrap(int x, int y, int z);
+        // Throws if value is not a valid palette index or does not fit into the cell type.
+        void checkValue(unsigned int value);
+        // Whether edits have to update the occupancy of the mesh, given the content stamp before them.
+        bool ownsOccupancy(uint64_t stampBefore);
+        void markDirty(glm::ivec3 p, bool solid, uint64_t stampBefore);
+        // Updates the brick map, the heightmap and the occupancy and marks [lo, hi) dirty after a bulk edit.
+        void markDirtyRegion(Content &c, glm::ivec3 lo, glm::ivec3 hi, uint64_t stampBefore);
+        void growDirtyRegion(glm::ivec3 lo, glm::ivec3 hi, uint64_t stampBefore);
+        static void fillRow(Content &c, int x, int y, int zLo, int zHi, unsigned int value);
+        // Plain cell array for importVoxels, CellStorage itself serves for PALETTE_PACKED.
+        template <class T>
+        struct RawCells {
+            T* cells;
+            unsigned int get(size_t i) const {return cells[i];}
+            void set(size_t i, unsigned int value) {cells[i] = value;}
+        };
+        template <class Record, class Cells>
+        void importVoxels(Content &c, Cells &cells, const Record* records, size_t count, uint64_t stampBefore,
+            bool updateOccupancy);
+        // Marks a cell which changed between empty and non-empty in the brick map and the heightmap.
+        static void setSolid(Content &c, glm::ivec3 p, bool solid);
+        void rebuildMesh();
+        // Generates the whole mesh into buffer, submitMesh passes it to the Renderer.
+        void buildMesh(VoxelMesher::MeshBuffer &buffer);
+        void submitMesh(VoxelMesher::MeshBuffer &buffer);
+        void submitMesh(const CachedMesh &cached);
+        void patchMesh();
 };
 
 
+template <class F>
+void TileMap3d::forEachInBox(glm::ivec3 lo, glm::ivec3 hi, F f) const {
+    content->brickMap.forEachBrick(lo, hi, [&](glm::ivec3 brickLo, glm::ivec3 brickHi) {
+        for (int x = brickLo.x; x < brickHi.x; x++) {
+            for (int y = brickLo.y; y < brickHi.y; y++) {
+                for (int z = brickLo.z; z < brickHi.z; z++) {
+                    unsigned int value = getUnchecked(x, y, z);
+                    if (value != 0) {
+                        f(glm::ivec3(x, y, z), value);
+                    }
+                }
+            }
+        }
+    });
+}
+
+
+template <class Record>
+void TileMap3d::importVoxels(const Record* records, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    // Narrow record values (byte indices of a 256 color palette) are in range without looking at them.
+    typedef decltype(records[0].colorIndex) Value;
+    unsigned int maxValue = std::numeric_limits<Value>::max();
+    if (maxValue >= std::min<size_t>(palette->size(), (size_t)CellStorage::maxValue(content->cells.getType()) + 1)) {
+        maxValue = 0;
+        for (size_t i = 0; i < count; i++) {
+            maxValue = std::max<unsigned int>(maxValue, records[i].colorIndex);
+        }
+    }
+    checkValue(maxValue);
+
+    meshOutdated = true;
+    const uint64_t stampBefore = content.stamp();
+    const bool updateOccupancy = ownsOccupancy(stampBefore);
+    Content &c = content.write();
+    switch (c.cells.getType()) {
+        case CellType::UINT8: {
+            RawCells<uint8_t> cells{c.cells.data<uint8_t>()};
+            importVoxels(c, cells, records, count, stampBefore, updateOccupancy);
+            break;
+        }
+        case CellType::UINT16: {
+            RawCells<uint16_t> cells{c.cells.data<uint16_t>()};
+            importVoxels(c, cells, records, count, stampBefore, updateOccupancy);
+            break;
+        }
+        case CellType::UINT32: {
+            RawCells<uint32_t> cells{c.cells.data<uint32_t>()};
+            importVoxels(c, cells, records, count, stampBefore, updateOccupancy);
+            break;
+        }
+        default:
+            importVoxels(c, c.cells, records, count, stampBefore, updateOccupancy);
+            break;
+    }
+    if (updateOccupancy) {
+        mesh->occupancyStamp = content.stamp();
+    }
+}
+
+
+template <class Record, class Cells>
+void TileMap3d::importVoxels(Content &c, Cells &cells, const Record* records, size_t count, uint64_t stampBefore,
+        bool updateOccupancy) {
+    glm::ivec3 lo(xSize, ySize, zSize), hi(-1);
+    for (size_t n = 0; n < count; n++) {
+        const Record &record = records[n];
+        glm::ivec3 p(record.x, record.y, record.z);
+        if ((unsigned int)p.x >= (unsigned int)xSize || (unsigned int)p.y >= (unsigned int)ySize
+            || (unsigned int)p.z >= (unsigned int)zSize) {
+            p = wrap(p.x, p.y, p.z);
+        }
+        const int i = c.indexer(p.x, p.y, p.z);
+        const bool solid = record.colorIndex != 0;
+        const bool changed = (cells.get(i) != 0) != solid;
+        cells.set(i, record.colorIndex);
+        if (changed) {
+            setSolid(c, p, solid);
+            if (updateOccupancy) {
+                mesh->occupancy.set(p.x, p.y, p.z, solid);
+            }
+        }
+        lo = glm::min(lo, p);
+        hi = glm::max(hi, p);
+    }
+    growDirtyRegion(lo, hi, stampBefore);
+}
+
 
 
 struct TileInfo {
@@ -87,10 +359,17 @@ class TileMap3dT {
         std::vector<MeshRenderObject> meshes;
 
         //TileMap3d() : xSize(0), ySize(0), zSize(0), content(0) {};
-        TileMap3dT(const std::vector<T> palette, int xSize, int ySize, int zSize);
-        TileMap3dT(const std::vector<T> palette, int xSize);
+        TileMap3dT(const std::vector<T> &palette, int xSize, int ySize, int zSize, CellType cellType = CellType::UINT32,
+            CellLayout layout = CellLayout::LINEAR);
+        TileMap3dT(const std::vector<T> &palette, int xSize, CellType cellType = CellType::UINT32, 
+            CellLayout layout = CellLayout::LINEAR);
 
         // TileMap3dT(const TileMap3dT &other);
+
+        // Index and rotation of a cell are stored together as index | rot << 16, so UINT8 and UINT16
+        // cannot hold rotated tiles.
+        CellType getCellType() {return content.getType();}
+        void setCellType(CellType cellType) {content.setType(cellType);}
         
         int index(int x, int y, int z);
         unsigned short get(int x, int y, int z);
@@ -100,6 +379,11 @@ class TileMap3dT {
         TileInfo getRaw(int x, int y, int z);
         TileInfo getRaw(glm::ivec3 k);
 
+        // Unchecked access for hot loops, coordinates must lie inside the map.
+        int indexUnchecked(int x, int y, int z) const {return indexer(x, y, z);}
+        TileInfo getRawUnchecked(int x, int y, int z) const {return unpackInfo(content.get(indexer(x, y, z)));}
+        unsigned short getUnchecked(int x, int y, int z) const {return getRawUnchecked(x, y, z).index;}
+
         T* getTile(int x, int y, int z);
         T* getTile(glm::ivec3 k);
 
@@ -112,15 +396,45 @@ class TileMap3dT {
 
         std::vector<MeshRenderObject> getRenderables();
 
+        // Column heightmap of the cells with a non-zero tile index, z pointing up, kept up to date by set.
+        // Coordinates must lie inside the map.
+        const ColumnHeightmap& getHeightmap() const {return heightmap;}
+        // Height of the top tile of column (x, y) plus one, 0 if the column is empty.
+        int surfaceHeight(int x, int y) const {return heightmap.surfaceHeight(x, y);}
+        // Top of the highest tile of the column below z plus one, 0 if there is none.
+        int groundHeight(int x, int y, int z) const;
+
+        // First cell with a non-zero tile index along the ray, the hit value is the tile index. Tiles
+        // are treated as solid cubes. Cell (x, y, z) covers [x, x + 1) on every axis, a world position
+        // p is at p / tile_size + 0.5 since tiles are rendered centered on x * tile_size.
+        RayHit raycast(const Ray &ray) const;
+        std::vector<RayHit> raycastMany(const std::vector<Ray> &rays) const;
+
         glm::vec3 center();
-        int getXSize() {return xSize;}
-        int getYSize() {return ySize;}
-        int getZSize() {return zSize;}
+        int getXSize() const {return xSize;}
+        int getYSize() const {return ySize;}
+        int getZSize() const {return zSize;}
 
     private:
         int xSize, ySize, zSize;
         bool needMeshUpdate = true;
-        std::vector<TileInfo> content;
+        CellIndexer indexer;
+        CellStorage content;
+        // Occupancy of cells with a non-zero tile index.
+        BrickMap brickMap;
+        ColumnHeightmap heightmap;
+
+        static unsigned int packInfo(TileInfo info) {return info.index | (unsigned int)info.rot << 16;}
+        static TileInfo unpackInfo(unsigned int cell) {return {(unsigned short)(cell & 0xffff), (unsigned short)(cell >> 16)};}
+        glm::ivec3 wrap(int x, int y, int z);
+        void setCell(glm::ivec3 p, TileInfo info);
+
+        // Tile indices for VoxelRaycast.
+        struct RaycastSource {
+            const TileMap3dT* map;
+            glm::ivec3 size() const {return glm::ivec3(map->xSize, map->ySize, map->zSize);}
+            unsigned int get(int x, int y, int z) const {return map->getUnchecked(x, y, z);}
+        };
 
     public: 
         std::vector<T> palette;
@@ -137,23 +451,31 @@ TileMap3d* createExampleTileMap(std::vector<Tile> palette, int spacing = 0);
 // TileMap with non-fixed tile.
 
 template <class T>
-TileMap3dT<T>::TileMap3dT(const std::vector<T> palette, int xSize, int ySize, int zSize) : \
+TileMap3dT<T>::TileMap3dT(const std::vector<T> &palette, int xSize, int ySize, int zSize, CellType cellType, 
+        CellLayout layout) : \
         xSize(xSize), 
         ySize(ySize), 
-        zSize(zSize), palette (palette)
+        zSize(zSize), 
+        indexer(xSize, ySize, zSize, layout),
+        content(cellType, indexer.cellCount()),
+        brickMap(glm::ivec3(xSize, ySize, zSize)),
+        heightmap(glm::ivec3(xSize, ySize, zSize)),
+        palette (palette)
 {
-    content.resize(xSize * ySize * zSize);
 }
 
 
 template <class T>
-TileMap3dT<T>::TileMap3dT(const std::vector<T> palette, int xSize) : \
+TileMap3dT<T>::TileMap3dT(const std::vector<T> &palette, int xSize, CellType cellType, CellLayout layout) : \
         xSize(xSize), 
         ySize(xSize), 
         zSize(xSize),
+        indexer(xSize, xSize, xSize, layout),
+        content(cellType, indexer.cellCount()),
+        brickMap(glm::ivec3(xSize)),
+        heightmap(glm::ivec3(xSize)),
         palette(palette)
 {
-    content.resize(xSize * ySize * zSize);
 }
 
 // template <class T>
@@ -169,19 +491,25 @@ TileMap3dT<T>::TileMap3dT(const std::vector<T> palette, int xSize) : \
 
 
 template <class T>
-int TileMap3dT<T>::index(int x, int y, int z) {
+glm::ivec3 TileMap3dT<T>::wrap(int x, int y, int z) {
     x = x % xSize;
     if (x < 0) x += xSize;
     y = y % ySize;
     if (y < 0) y += ySize;
     z = z % zSize;
     if (z < 0) z += zSize;
-    return x * ySize * zSize + y * zSize + z;
+    return glm::ivec3(x, y, z);
+}
+
+template <class T>
+int TileMap3dT<T>::index(int x, int y, int z) {
+    glm::ivec3 p = wrap(x, y, z);
+    return indexer(p.x, p.y, p.z);
 }
 
 template <class T>
 TileInfo TileMap3dT<T>::getRaw(int x, int y, int z) {
-    return content[index(x, y, z)];
+    return unpackInfo(content.get(index(x, y, z)));
 }
 
 
@@ -192,7 +520,7 @@ TileInfo TileMap3dT<T>::getRaw(glm::ivec3 k) {
 
 template <class T>
 unsigned short TileMap3dT<T>::get(int x, int y, int z) {
-    return content[index(x, y, z)].index;
+    return getRaw(x, y, z).index;
 }
 
 template <class T>
@@ -203,7 +531,7 @@ unsigned short TileMap3dT<T>::get(glm::ivec3 k) {
 
 template <class T> 
 unsigned short TileMap3dT<T>::getRot(int x, int y, int z) {
-    return content[index(x, y, z)].rot;
+    return getRaw(x, y, z).rot;
 }
 
 
@@ -231,7 +559,7 @@ void TileMap3dT<T>::setRaw(int x, int y, int z, TileInfo value) {
     if (value.index >= palette.size()) {
         throw std::invalid_argument( "Tile index " + std::to_string(value.index) + " out of range: 0 - " + std::to_string(palette.size()) );
     }
-    content[index(x, y, z)] = value;
+    setCell(wrap(x, y, z), value);
 }
 
 template <class T>
@@ -245,7 +573,10 @@ void TileMap3dT<T>::set(int x, int y, int z, unsigned short v) {
     if (v >= palette.size()) {
         throw std::invalid_argument( "Tile index " + std::to_string(v) + " out of range: 0 - " + std::to_string(palette.size()) );
     }
-    content[index(x, y, z)].index = v;
+    glm::ivec3 p = wrap(x, y, z);
+    TileInfo info = getRawUnchecked(p.x, p.y, p.z);
+    info.index = v;
+    setCell(p, info);
 }
 template <class T>
 void TileMap3dT<T>::set(glm::ivec3 k, unsigned short v) {
@@ -258,7 +589,34 @@ void TileMap3dT<T>::setRot(int x, int y, int z, unsigned short rot) {
     if (rot >= 48) {
         throw std::invalid_argument( "Rotation " + std::to_string(rot) + " out of range.");
     }
-    content[index(x, y, z)].rot = rot;
+    glm::ivec3 p = wrap(x, y, z);
+    TileInfo info = getRawUnchecked(p.x, p.y, p.z);
+    info.rot = rot;
+    setCell(p, info);
+}
+
+template <class T>
+void TileMap3dT<T>::setCell(glm::ivec3 p, TileInfo info) {
+    unsigned int cell = packInfo(info);
+    if (cell > CellStorage::maxValue(content.getType())) {
+        throw std::invalid_argument( "Tile " + std::to_string(info.index) + " with rotation " + std::to_string(info.rot) + " does not fit into the cell type" );
+    }
+    const int i = indexer(p.x, p.y, p.z);
+    const bool changed = (unpackInfo(content.get(i)).index != 0) != (info.index != 0);
+    content.set(i, cell);
+    if (changed) {
+        brickMap.setSolid(p, info.index != 0);
+        heightmap.setSolid(p, info.index != 0, [&](glm::ivec3 q) {
+            return getUnchecked(q.x, q.y, q.z) != 0;
+        });
+    }
+}
+
+template <class T>
+int TileMap3dT<T>::groundHeight(int x, int y, int z) const {
+    return heightmap.groundHeight(x, y, z, [&](glm::ivec3 p) {
+        return getUnchecked(p.x, p.y, p.z) != 0;
+    });
 }
 template <class T>
 void TileMap3dT<T>::setRot(glm::ivec3 k, unsigned short rot) {
@@ -269,33 +627,47 @@ template <class T>
 std::vector<MeshRenderObject> TileMap3dT<T>::getRenderables() {
     if (needMeshUpdate) {
         meshes = std::vector<MeshRenderObject>();
-        for (int x = 0; x < xSize; x++) {
-            for (int y = 0; y < ySize; y++) {
-                for (int z = 0; z < zSize; z++) {
-                    MeshRenderObject meshInstance;
-                    if (get(x, y, z) == 0) continue;
-                    T* tile = getTile(x, y, z);
-                    auto rot = getRot(x, y, z);
-                    auto rot_quat = glm::quat_cast(utils::i2cs[rot]);
-                    // for (int i = 0; i < 4; i++) {
-                    //     std::cout << rot_quat[0] << ", " << rot_quat[1];
-                    // }
-
-                    if (tile->meshID == 0) {
-                        tile->updateMesh();
+        // Only bricks containing tiles are visited.
+        brickMap.forEachBrick(glm::ivec3(0), glm::ivec3(xSize, ySize, zSize), [&](glm::ivec3 lo, glm::ivec3 hi) {
+            for (int x = lo.x; x < hi.x; x++) {
+                for (int y = lo.y; y < hi.y; y++) {
+                    for (int z = lo.z; z < hi.z; z++) {
+                        MeshRenderObject meshInstance;
+                        TileInfo info = getRawUnchecked(x, y, z);
+                        if (info.index == 0) continue;
+                        T* tile = &palette[info.index];
+                        auto rot = info.rot;
+                        auto rot_quat = glm::quat_cast(utils::i2cs[rot]);
+                        // for (int i = 0; i < 4; i++) {
+                        //     std::cout << rot_quat[0] << ", " << rot_quat[1];
+                        // }
+
+                        if (tile->meshID == 0) {
+                            tile->updateMesh();
+                        }
+                        meshInstance.meshID = tile->meshID;
+                       // meshInstance.transform = Transform(glm::vec3(x * tile_size, y * tile_size, z * tile_size), rot_quat);
+                        meshInstance.transform = Transform(glm::vec3(x * tile_size, y * tile_size, z * tile_size));
+                        meshes.emplace_back(meshInstance);
                     }
-                    meshInstance.meshID = tile->meshID;
-                   // meshInstance.transform = Transform(glm::vec3(x * tile_size, y * tile_size, z * tile_size), rot_quat);
-                    meshInstance.transform = Transform(glm::vec3(x * tile_size, y * tile_size, z * tile_size));
-                    meshes.emplace_back(meshInstance);
                 }
             }
-        }
+        });
     }
     needMeshUpdate = false;
     return meshes;
 }
 
+template <class T>
+RayHit TileMap3dT<T>::raycast(const Ray &ray) const {
+    return VoxelRaycast::cast(RaycastSource{this}, brickMap, ray);
+}
+
+template <class T>
+std::vector<RayHit> TileMap3dT<T>::raycastMany(const std::vector<Ray> &rays) const {
+    return VoxelRaycast::castMany(RaycastSource{this}, brickMap, rays);
+}
+
 // template <class T>
 // void TileMap3dT<T>::draw(ShaderProgram& shaderProgram, glm::mat4 transform/* = glm::mat4(1.0f)*/) {
 //     for (int x = 0; x < xSize; x++) {
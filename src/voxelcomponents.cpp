@@ -0,0 +1,458 @@
+
+#include "voxelcomponents.h"
+#include "threadpool.h"
+
+#include <glm/common.hpp> // glm::min, glm::max
+#include <glm/vector_relational.hpp> // glm::any, glm::lessThan
+
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+
+namespace {
+// Union-find over cell indices, -1 marks empty cells. Roots are the smallest index of their set.
+int findRoot(const std::vector<int> &parent, int i) {
+    while (parent[i] != i) {
+        i = parent[i];
+    }
+    return i;
+}
+
+// Halves the paths it walks, which only changes entries of the two sets.
+int findRootCompressing(std::vector<int> &parent, int i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+void unite(std::vector<int> &parent, int a, int b) {
+    a = findRootCompressing(parent, a);
+    b = findRootCompressing(parent, b);
+    if (a == b) return;
+    if (a < b) {
+        parent[b] = a;
+    } else {
+        parent[a] = b;
+    }
+}
+
+void include(VoxelComponents::Component &component, glm::ivec3 p) {
+    if (component.voxelCount == 0) {
+        component.min = component.max = p;
+    } else {
+        component.min = glm::min(component.min, p);
+        component.max = glm::max(component.max, p);
+    }
+    component.voxelCount++;
+}
+
+void merge(VoxelComponents::Component &component, const VoxelComponents::Component &other) {
+    if (component.voxelCount == 0) {
+        component = other;
+        return;
+    }
+    component.min = glm::min(component.min, other.min);
+    component.max = glm::max(component.max, other.max);
+    component.voxelCount += other.voxelCount;
+}
+}
+
+
+void VoxelComponents::build(const TileMap3d &map) {
+    size = glm::ivec3(map.getXSize(), map.getYSize(), map.getZSize());
+    const glm::ivec3 chunks = (size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    const int chunkCount = chunks.x * chunks.y * chunks.z;
+    auto chunkBounds = [&](int chunk, glm::ivec3 &lo, glm::ivec3 &hi) {
+        glm::ivec3 c(chunk / (chunks.y * chunks.z), (chunk / chunks.z) % chunks.y, chunk % chunks.z);
+        lo = c * CHUNK_SIZE;
+        hi = glm::min(lo + CHUNK_SIZE, size);
+    };
+
+    // Sets inside a chunk only link cells of that chunk, so the chunks are labelled in parallel.
+    std::vector<int> parent(size.x * size.y * size.z);
+    ThreadPool::shared().parallelFor(chunkCount, [&](int chunk) {
+        glm::ivec3 lo, hi;
+        chunkBounds(chunk, lo, hi);
+        for (int x = lo.x; x < hi.x; x++) {
+            for (int y = lo.y; y < hi.y; y++) {
+                for (int z = lo.z; z < hi.z; z++) {
+                    const int i = index(x, y, z);
+                    if (map.getUnchecked(x, y, z) == 0) {
+                        parent[i] = -1;
+                        continue;
+                    }
+                    parent[i] = i;
+                    if (x > lo.x && parent[index(x - 1, y, z)] >= 0) unite(parent, i, index(x - 1, y, z));
+                    if (y > lo.y && parent[index(x, y - 1, z)] >= 0) unite(parent, i, index(x, y - 1, z));
+                    if (z > lo.z && parent[index(x, y, z - 1)] >= 0) unite(parent, i, index(x, y, z - 1));
+                }
+            }
+        }
+    });
+
+    // Join the sets of neighbouring chunks across their faces.
+    for (int axis = 0; axis < 3; axis++) {
+        const int u = (axis + 1) % 3, v = (axis + 2) % 3;
+        for (int plane = CHUNK_SIZE; plane < size[axis]; plane += CHUNK_SIZE) {
+            glm::ivec3 p;
+            p[axis] = plane;
+            for (p[u] = 0; p[u] < size[u]; p[u]++) {
+                for (p[v] = 0; p[v] < size[v]; p[v]++) {
+                    glm::ivec3 q = p;
+                    q[axis]--;
+                    const int a = index(p.x, p.y, p.z), b = index(q.x, q.y, q.z);
+                    if (parent[a] >= 0 && parent[b] >= 0) {
+                        unite(parent, a, b);
+                    }
+                }
+            }
+        }
+    }
+
+    // Number the roots in index order, then label every cell with the number of its root.
+    labels.assign(parent.size(), 0);
+    ThreadPool::shared().parallelFor(chunkCount, [&](int chunk) {
+        glm::ivec3 lo, hi;
+        chunkBounds(chunk, lo, hi);
+        for (int x = lo.x; x < hi.x; x++) {
+            for (int y = lo.y; y < hi.y; y++) {
+                for (int z = lo.z; z < hi.z; z++) {
+                    const int i = index(x, y, z);
+                    labels[i] = parent[i] < 0 ? -1 : findRoot(parent, i);
+                }
+            }
+        }
+    });
+    components.assign(1, Component());
+    freeIds.clear();
+    for (size_t i = 0; i < labels.size(); i++) {
+        if (labels[i] == (int)i) {
+            parent[i] = components.size();
+            components.emplace_back();
+        }
+    }
+    liveCount = components.size() - 1;
+
+    std::vector<std::unordered_map<int, Component>> chunkComponents(chunkCount);
+    ThreadPool::shared().parallelFor(chunkCount, [&](int chunk) {
+        glm::ivec3 lo, hi;
+        chunkBounds(chunk, lo, hi);
+        for (int x = lo.x; x < hi.x; x++) {
+            for (int y = lo.y; y < hi.y; y++) {
+                for (int z = lo.z; z < hi.z; z++) {
+                    int &label = labels[index(x, y, z)];
+                    if (label < 0) {
+                        label = 0;
+                        continue;
+                    }
+                    label = parent[label];
+                    include(chunkComponents[chunk][label], glm::ivec3(x, y, z));
+                }
+            }
+        }
+    });
+    for (const auto &local : chunkComponents) {
+        for (const auto &it : local) {
+            merge(components[it.first], it.second);
+        }
+    }
+    changes.clear();
+}
+
+
+void VoxelComponents::markChanged(glm::ivec3 lo, glm::ivec3 hi) {
+    changes.emplace_back(lo, hi);
+}
+
+
+int VoxelComponents::newId() {
+    liveCount++;
+    if (!freeIds.empty()) {
+        int id = freeIds.back();
+        freeIds.pop_back();
+        return id;
+    }
+    components.emplace_back();
+    return components.size() - 1;
+}
+
+
+void VoxelComponents::removeComponent(int id) {
+    components[id] = Component();
+    freeIds.push_back(id);
+    liveCount--;
+}
+
+
+std::vector<int> VoxelComponents::update(const TileMap3d &map) {
+    std::vector<int> created;
+    if (changes.empty()) {
+        return created;
+    }
+    if (size != glm::ivec3(map.getXSize(), map.getYSize(), map.getZSize())) {
+        build(map);
+        for (int id = 1; id < (int)components.size(); id++) {
+            created.push_back(id);
+        }
+        return created;
+    }
+
+    // Removed cells lose their label, added cells are labelled -1 for now.
+    std::vector<glm::ivec3> removed, added;
+    std::vector<int> shrunk;
+    // Components whose bounds may have shrunk because a cell on them was removed.
+    std::unordered_set<int> staleBounds;
+    for (auto &change : changes) {
+        const glm::ivec3 lo = glm::max(change.first, glm::ivec3(0));
+        const glm::ivec3 hi = glm::min(change.second, size);
+        for (int x = lo.x; x < hi.x; x++) {
+            for (int y = lo.y; y < hi.y; y++) {
+                for (int z = lo.z; z < hi.z; z++) {
+                    int &label = labels[index(x, y, z)];
+                    const bool solid = map.getUnchecked(x, y, z) != 0;
+                    if (label > 0 && !solid) {
+                        Component &component = components[label];
+                        const glm::ivec3 p(x, y, z);
+                        if (glm::any(glm::equal(p, component.min)) || glm::any(glm::equal(p, component.max))) {
+                            staleBounds.insert(label);
+                        }
+                        component.voxelCount--;
+                        shrunk.push_back(label);
+                        removed.push_back(glm::ivec3(x, y, z));
+                        label = 0;
+                    } else if (label == 0 && solid) {
+                        added.push_back(glm::ivec3(x, y, z));
+                        label = -1;
+                    }
+                }
+            }
+        }
+    }
+    changes.clear();
+    std::sort(shrunk.begin(), shrunk.end());
+    shrunk.erase(std::unique(shrunk.begin(), shrunk.end()), shrunk.end());
+    for (int id : shrunk) {
+        if (components[id].voxelCount == 0) {
+            removeComponent(id);
+        }
+    }
+
+    addCells(added, created, staleBounds);
+
+    // Components which lost cells may have split. All parts have a cell next to a removed cell.
+    std::unordered_map<int, std::vector<glm::ivec3>> seeds;
+    for (glm::ivec3 p : removed) {
+        for (int axis = 0; axis < 3; axis++) {
+            for (int side = -1; side <= 1; side += 2) {
+                glm::ivec3 q = p;
+                q[axis] += side;
+                if (q[axis] < 0 || q[axis] >= size[axis]) continue;
+                const int label = labels[index(q.x, q.y, q.z)];
+                if (label > 0) {
+                    seeds[label].push_back(q);
+                }
+            }
+        }
+    }
+    for (const auto &it : seeds) {
+        split(it.first, it.second, created, staleBounds.count(it.first) > 0);
+    }
+    return created;
+}
+
+
+void VoxelComponents::relabel(int from, int to) {
+    const Component component = components[from];
+    for (int x = component.min.x; x <= component.max.x; x++) {
+        for (int y = component.min.y; y <= component.max.y; y++) {
+            for (int z = component.min.z; z <= component.max.z; z++) {
+                int &label = labels[index(x, y, z)];
+                if (label == from) {
+                    label = to;
+                }
+            }
+        }
+    }
+    merge(components[to], component);
+    removeComponent(from);
+}
+
+
+void VoxelComponents::addCells(const std::vector<glm::ivec3> &added, std::vector<int> &created,
+    std::unordered_set<int> &staleBounds)
+{
+    // Each connected group of added cells joins the components next to it, which are merged into
+    // the largest of them, or becomes a new component.
+    std::vector<glm::ivec3> group, stack;
+    std::vector<int> neighbours;
+    for (glm::ivec3 start : added) {
+        if (labels[index(start.x, start.y, start.z)] != -1) continue;
+
+        group.clear();
+        neighbours.clear();
+        labels[index(start.x, start.y, start.z)] = -2;
+        stack.push_back(start);
+        while (!stack.empty()) {
+            const glm::ivec3 p = stack.back();
+            stack.pop_back();
+            group.push_back(p);
+            for (int axis = 0; axis < 3; axis++) {
+                for (int side = -1; side <= 1; side += 2) {
+                    glm::ivec3 q = p;
+                    q[axis] += side;
+                    if (q[axis] < 0 || q[axis] >= size[axis]) continue;
+                    int &label = labels[index(q.x, q.y, q.z)];
+                    if (label == -1) {
+                        label = -2;
+                        stack.push_back(q);
+                    } else if (label > 0 && std::find(neighbours.begin(), neighbours.end(), label) == neighbours.end()) {
+                        neighbours.push_back(label);
+                    }
+                }
+            }
+        }
+
+        int id;
+        if (neighbours.empty()) {
+            id = newId();
+            created.push_back(id);
+        } else {
+            id = neighbours[0];
+            for (int other : neighbours) {
+                if (components[other].voxelCount > components[id].voxelCount) {
+                    id = other;
+                }
+            }
+            for (int other : neighbours) {
+                if (other != id) {
+                    relabel(other, id);
+                    if (staleBounds.count(other) > 0) {
+                        staleBounds.insert(id);
+                    }
+                }
+            }
+        }
+        for (glm::ivec3 p : group) {
+            labels[index(p.x, p.y, p.z)] = id;
+            include(components[id], p);
+        }
+    }
+}
+
+
+void VoxelComponents::split(int id, const std::vector<glm::ivec3> &seeds, std::vector<int> &created, bool staleBounds) {
+    // One breadth-first search per seed, advanced in turns. Searches which meet are joined. A joined
+    // search which runs out of cells has found a separate part; once at most one search is left
+    // running, the remaining cells all belong to it and are not visited.
+    struct Search {
+        std::vector<glm::ivec3> frontier;
+        size_t next = 0;
+    };
+    std::vector<Search> searches;
+    std::vector<int> parent, pending, visitedCount;
+    std::unordered_map<int, int> visited;
+    for (glm::ivec3 seed : seeds) {
+        if (labels[index(seed.x, seed.y, seed.z)] != id || !visited.emplace(index(seed.x, seed.y, seed.z), searches.size()).second) {
+            continue;
+        }
+        parent.push_back(searches.size());
+        pending.push_back(1);
+        visitedCount.push_back(1);
+        searches.emplace_back();
+        searches.back().frontier.push_back(seed);
+    }
+
+    auto find = [&](int s) {
+        while (parent[s] != s) {
+            s = parent[s] = parent[parent[s]];
+        }
+        return s;
+    };
+
+    int running = searches.size();
+    while (running > 1) {
+        for (int s = 0; s < (int)searches.size() && running > 1; s++) {
+            Search &search = searches[s];
+            if (search.next == search.frontier.size()) continue;
+
+            const glm::ivec3 p = search.frontier[search.next++];
+            int set = find(s);
+            pending[set]--;
+            for (int axis = 0; axis < 3; axis++) {
+                for (int side = -1; side <= 1; side += 2) {
+                    glm::ivec3 q = p;
+                    q[axis] += side;
+                    if (q[axis] < 0 || q[axis] >= size[axis]) continue;
+                    const int i = index(q.x, q.y, q.z);
+                    if (labels[i] != id) continue;
+
+                    auto it = visited.emplace(i, s);
+                    if (it.second) {
+                        search.frontier.push_back(q);
+                        pending[set]++;
+                        visitedCount[set]++;
+                        continue;
+                    }
+                    const int other = find(it.first->second);
+                    if (other != set) {
+                        parent[other] = set;
+                        pending[set] += pending[other];
+                        visitedCount[set] += visitedCount[other];
+                        running--;
+                    }
+                }
+            }
+            if (pending[set] == 0) {
+                running--;
+            }
+        }
+    }
+
+    // The running search, or the largest part if all searches finished, keeps the id.
+    int keeper = -1;
+    for (int s = 0; s < (int)searches.size(); s++) {
+        if (find(s) != s) continue;
+        if (pending[s] > 0) {
+            keeper = s;
+            break;
+        }
+        if (keeper < 0 || visitedCount[s] > visitedCount[keeper]) {
+            keeper = s;
+        }
+    }
+    std::unordered_map<int, int> parts;
+    for (int s = 0; s < (int)searches.size(); s++) {
+        if (find(s) == s && s != keeper) {
+            parts[s] = newId();
+            created.push_back(parts[s]);
+        }
+    }
+    for (const auto &it : visited) {
+        auto part = parts.find(find(it.second));
+        if (part == parts.end()) continue;
+        const int i = it.first;
+        const glm::ivec3 p(i / (size.y * size.z), (i / size.z) % size.y, i % size.z);
+        labels[i] = part->second;
+        include(components[part->second], p);
+        components[id].voxelCount--;
+    }
+
+    // The bounds of the remaining cells may have shrunk.
+    if (parts.empty() && !staleBounds) {
+        return;
+    }
+    Component remaining;
+    for (int x = components[id].min.x; x <= components[id].max.x; x++) {
+        for (int y = components[id].min.y; y <= components[id].max.y; y++) {
+            for (int z = components[id].min.z; z <= components[id].max.z; z++) {
+                if (labels[index(x, y, z)] == id) {
+                    include(remaining, glm::ivec3(x, y, z));
+                }
+            }
+        }
+    }
+    components[id] = remaining;
+}
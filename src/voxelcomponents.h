@@ -0,0 +1,70 @@
+#ifndef VOXELCOMPONENTS_H
+#define VOXELCOMPONENTS_H
+
+#include <glm/vec3.hpp> // glm::ivec3
+
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "tilemap3d.h"
+
+
+// Connected components (islands) of the non-empty cells of a tilemap, with faces as connections.
+// build labels the whole map with a union-find over chunks. After edits, markChanged and update
+// only look at the changed cells: added cells join or merge their neighbouring components, and
+// for removed cells a search from their neighbours finds the parts which broke off. Its cost
+// depends on the size of these parts, not of the structure they broke off from.
+class VoxelComponents {
+    public:
+        // Labels are computed in chunks of CHUNK_SIZE^3 cells in parallel.
+        static const int CHUNK_SIZE = 32;
+
+        struct Component {
+            // 0 if the id is unused.
+            int voxelCount = 0;
+            // Inclusive bounds of the cells.
+            glm::ivec3 min = glm::ivec3(0), max = glm::ivec3(0);
+        };
+
+        // Labels all cells of the map.
+        void build(const TileMap3d &map);
+
+        // Remembers that cells in [lo, hi) changed since the last build or update.
+        void markChanged(glm::ivec3 lo, glm::ivec3 hi);
+        // Updates the labels after changes of the cells in the marked boxes. Merged components keep the
+        // id of the largest one, a split component keeps its id for the largest part (or the one not
+        // fully visited). Returns the ids of the new components, i.e. the parts which broke off and
+        // the islands of added cells.
+        std::vector<int> update(const TileMap3d &map);
+
+        // Component id of a cell, 0 for empty cells.
+        int componentAt(int x, int y, int z) const {return labels[index(x, y, z)];}
+        int componentAt(glm::ivec3 p) const {return componentAt(p.x, p.y, p.z);}
+        // Indexed by component id. Id 0 and ids of components removed by update are unused.
+        const std::vector<Component>& getComponents() const {return components;}
+        int componentCount() const {return liveCount;}
+
+    private:
+        glm::ivec3 size = glm::ivec3(0);
+        std::vector<int> labels;
+        std::vector<Component> components;
+        std::vector<int> freeIds;
+        int liveCount = 0;
+        std::vector<std::pair<glm::ivec3, glm::ivec3>> changes;
+
+        int index(int x, int y, int z) const {
+            return (x * size.y + y) * size.z + z;
+        }
+        int newId();
+        void removeComponent(int id);
+        // Moves the cells of component from to component to.
+        void relabel(int from, int to);
+        void addCells(const std::vector<glm::ivec3> &added, std::vector<int> &created, std::unordered_set<int> &staleBounds);
+        // Finds the parts of component id which broke off, starting from seeds. The bounds of the
+        // component are recomputed if parts broke off or staleBounds is set.
+        void split(int id, const std::vector<glm::ivec3> &seeds, std::vector<int> &created, bool staleBounds);
+};
+
+
+#endif // VOXELCOMPONENTS_H
@@ -0,0 +1,178 @@
+
+#include "voxelmesher.h"
+
+#include <algorithm>
+
+
+const VoxelMesher::FaceDirection VoxelMesher::faceDirections[6] = {
+    {0,  1, 1, 2, { 1, 0, 0}, {0,  1, 0}, {0, 0, 1}},
+    {0, -1, 1, 2, {-1, 0, 0}, {0, -1, 0}, {0, 0, 1}},
+    {1,  1, 2, 0, {0,  1, 0}, {0, 0,  1}, {1, 0, 0}},
+    {1, -1, 2, 0, {0, -1, 0}, {0, 0, -1}, {1, 0, 0}},
+    {2,  1, 0, 1, {0, 0,  1}, { 1, 0, 0}, {0, 1, 0}},
+    {2, -1, 0, 1, {0, 0, -1}, {-1, 0, 0}, {0, 1, 0}},
+};
+
+
+bool VoxelMesher::canPack(const Palette &palette, glm::ivec3 size) {
+    // Centered meshes reach from -size to size in half voxel units.
+    int extent = 2 * std::max(size.x, std::max(size.y, size.z));
+    return palette.size() <= Renderer::PACKED_PALETTE_SIZE && extent <= Renderer::PACKED_POSITION_LIMIT;
+}
+
+
+std::vector<glm::vec4> VoxelMesher::packedPalette(const Palette &palette) {
+    std::vector<glm::vec4> colors;
+    colors.reserve(Renderer::PACKED_PALETTE_SIZE);
+    for (const Tile &tile : palette) {
+        colors.push_back(tile.color);
+    }
+    colors.resize(Renderer::PACKED_PALETTE_SIZE);
+    return colors;
+}
+
+
+void VoxelMesher::addQuad(MeshBuffer &out, const FaceDirection &dir, int slice, int u, int v, int width, int height,
+    const Palette &palette, unsigned int tileState, glm::vec3 offset)
+{
+    // Corners in the order v0 = +t +b, v1 = -t +b, v2 = -t -b, v3 = +t -b
+    bool tangentPositive = dir.tangent[dir.uAxis] > 0;
+    float uPlus = tangentPositive ? u + width : u;
+    float uMinus = tangentPositive ? u : u + width;
+    unsigned int index = out.vertexCount();
+
+    for (int c = 0; c < 4; c++) {
+        glm::vec3 corner;
+        corner[dir.axis] = dir.sign > 0 ? slice + 1 : slice;
+        corner[dir.uAxis] = (c == 0 || c == 3) ? uPlus : uMinus;
+        corner[dir.vAxis] = (c == 0 || c == 1) ? v + height : v;
+
+        if (out.packed) {
+            glm::vec3 position = 2.0f * (corner - offset);
+            Renderer::PackedVertex vertex = {
+                {(short)position.x, (short)position.y, (short)position.z}, 
+                (unsigned char)(&dir - faceDirections), 
+                (unsigned char)tileState
+            };
+            out.packedVertices.push_back(vertex);
+        } else {
+            out.vertices.push_back({corner - offset, dir.normal, palette[tileState].color});
+        }
+    }
+
+    out.indices.push_back(index);
+    out.indices.push_back(index + 1);
+    out.indices.push_back(index + 2);
+
+    out.indices.push_back(index);
+    out.indices.push_back(index + 2);
+    out.indices.push_back(index + 3);
+}
+
+
+void VoxelMesher::greedyMergeMask(std::vector<unsigned int> &mask, int sizeU, int sizeV, const FaceDirection &dir,
+    int slice, const Palette &palette, glm::vec3 offset, MeshBuffer &out)
+{
+    for (int v = 0; v < sizeV; v++) {
+        for (int u = 0; u < sizeU; ) {
+            unsigned int tileState = mask[u + v * sizeU];
+            if (tileState == 0) {
+                u++;
+                continue;
+            }
+
+            int width = 1;
+            while (u + width < sizeU && mask[u + width + v * sizeU] == tileState) {
+                width++;
+            }
+
+            int height = 1;
+            for (; v + height < sizeV; height++) {
+                bool rowMatches = true;
+                for (int k = 0; k < width; k++) {
+                    if (mask[u + k + (v + height) * sizeU] != tileState) {
+                        rowMatches = false;
+                        break;
+                    }
+                }
+                if (!rowMatches) break;
+            }
+
+            for (int l = 0; l < height; l++) {
+                std::fill_n(mask.begin() + u + (v + l) * sizeU, width, 0);
+            }
+
+            addQuad(out, dir, slice, u, v, width, height, palette, tileState, offset);
+            u += width;
+        }
+    }
+}
+
+
+int VoxelMesher::segmentCount(glm::ivec3 size, MeshingMode mode) {
+    if (mode == MeshingMode::GREEDY) {
+        return 2 * (size.x + size.y + size.z);
+    }
+    return size.x;
+}
+
+
+void VoxelMesher::greedySegment(glm::ivec3 size, int segment, int &direction, int &slice) {
+    direction = 0;
+    while (segment >= size[faceDirections[direction].axis]) {
+        segment -= size[faceDirections[direction].axis];
+        direction++;
+    }
+    slice = segment;
+}
+
+
+std::vector<int> VoxelMesher::segmentsAround(glm::ivec3 size, MeshingMode mode, glm::ivec3 lo, glm::ivec3 hi) {
+    // Faces of neighbouring voxels change visibility as well.
+    lo = glm::max(lo - 1, glm::ivec3(0));
+    hi = glm::min(hi + 1, size - 1);
+
+    std::vector<int> segments;
+    if (mode == MeshingMode::GREEDY) {
+        int first = 0;
+        for (const FaceDirection &dir : faceDirections) {
+            for (int slice = lo[dir.axis]; slice <= hi[dir.axis]; slice++) {
+                segments.push_back(first + slice);
+            }
+            first += size[dir.axis];
+        }
+    } else {
+        for (int x = lo.x; x <= hi.x; x++) {
+            segments.push_back(x);
+        }
+    }
+    return segments;
+}
+
+
+void VoxelMesher::concatenate(const std::vector<MeshBuffer> &segments, MeshBuffer &out) {
+    size_t vertexCount = out.vertexCount(), indexCount = out.indices.size();
+    for (const MeshBuffer &segment : segments) {
+        assert(segment.packed == out.packed);
+        vertexCount += segment.vertexCount();
+        indexCount += segment.indices.size();
+    }
+    if (out.packed) {
+        out.packedVertices.reserve(vertexCount);
+    } else {
+        out.vertices.reserve(vertexCount);
+    }
+    out.indices.reserve(indexCount);
+
+    for (const MeshBuffer &segment : segments) {
+        unsigned int base = out.vertexCount();
+        if (out.packed) {
+            out.packedVertices.insert(out.packedVertices.end(), segment.packedVertices.begin(), segment.packedVertices.end());
+        } else {
+            out.vertices.insert(out.vertices.end(), segment.vertices.begin(), segment.vertices.end());
+        }
+        for (unsigned int index : segment.indices) {
+            out.indices.push_back(base + index);
+        }
+    }
+}
@@ -0,0 +1,314 @@
+#ifndef VOXELMESHER_H
+#define VOXELMESHER_H
+
+#include <glm/vec3.hpp> // glm::vec3
+#include <glm/vec4.hpp> // glm::vec4
+
+#include <vector>
+
+#include "mesh.h"
+#include "occupancy.h"
+#include "threadpool.h"
+#include "tilemap3d.h"
+
+
+// Mesh generation for voxel volumes. The functions are templated on a voxel source which needs
+// to provide the following methods:
+//     glm::ivec3 size() const;                  extent of the volume, voxels are in [0, size)
+//     unsigned int get(int x, int y, int z) const;    palette index of a voxel inside the volume
+//     bool isEmpty(int x, int y, int z) const;  whether faces towards (x, y, z) are visible. Is
+//                                               also called for coordinates one voxel outside.
+// If an OccupancyMask built from the same source is passed, visible faces are taken from it instead
+// of testing the six neighbours of every voxel. The output is the same.
+namespace VoxelMesher {
+
+
+// Output of the mesher. If packed is set, vertices are written to packedVertices instead of vertices.
+struct MeshBuffer {
+    bool packed = false;
+    std::vector<Renderer::Vertex> vertices;
+    std::vector<Renderer::PackedVertex> packedVertices;
+    std::vector<unsigned int> indices;
+
+    unsigned int vertexCount() const {
+        return packed ? packedVertices.size() : vertices.size();
+    }
+};
+
+
+// Whether meshes of a volume with the given palette and extent can use packed vertices.
+bool canPack(const Palette &palette, glm::ivec3 size);
+
+// Palette colors uploaded with packed meshes.
+std::vector<glm::vec4> packedPalette(const Palette &palette);
+
+
+// Face directions in the order +x, -x, +y, -y, +z, -z. Tangent and bitangent are unit vectors
+// along the axes u and v; the bitangent always points in positive direction.
+struct FaceDirection {
+    int axis, sign;
+    int uAxis, vAxis;
+    glm::vec3 normal, tangent, bitangent;
+};
+
+extern const FaceDirection faceDirections[6];
+
+
+// Appends the quad covering voxels [u, u + width) x [v, v + height) of the given slice.
+void addQuad(MeshBuffer &out, const FaceDirection &dir, int slice, int u, int v, int width, int height,
+    const Palette &palette, unsigned int tileState, glm::vec3 offset);
+
+
+// Naive meshing of layer x using the occupancy bits. Voxels and faces are visited in the same order as
+// by the scalar path: z ascending within every y, and the faces of a voxel in faceDirections order.
+template <class Source>
+void generateNaiveLayer(const Source &source, const OccupancyMask &occupancy, int x, const Palette &palette,
+    glm::vec3 offset, MeshBuffer &out)
+{
+    const glm::ivec3 size = source.size();
+    const int words = occupancy.wordsPerColumn();
+
+    uint64_t faces[6];
+    for (int y = 0; y < size.y; y++) {
+        for (int w = 0; w < words; w++) {
+            if (occupancy.column(x, y, w) == 0) continue;
+
+            uint64_t any = 0;
+            for (int d = 0; d < 6; d++) {
+                faces[d] = occupancy.visibleFaces(x, y, w, d);
+                any |= faces[d];
+            }
+
+            while (any != 0) {
+                int bit = __builtin_ctzll(any);
+                any &= any - 1;
+                const glm::ivec3 p(x, y, 64 * w + bit);
+                unsigned int tileState = source.get(p.x, p.y, p.z);
+                for (int d = 0; d < 6; d++) {
+                    if ((faces[d] >> bit) & 1) {
+                        const FaceDirection &dir = faceDirections[d];
+                        addQuad(out, dir, p[dir.axis], p[dir.uAxis], p[dir.vAxis], 1, 1, palette, tileState, offset);
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+// One quad for every exposed face of the voxels in layer x.
+template <class Source>
+void generateNaiveLayer(const Source &source, int x, const Palette &palette, glm::vec3 offset, MeshBuffer &out)
+{
+    //    v6----- v5
+	//   /|      /|
+	//  v1------v0|
+	//  | |     | |
+	//  | v7----|-v4
+	//  |/      |/
+	//  v2------v3
+
+    const glm::ivec3 size = source.size();
+    for (int y = 0; y < size.y; y++) {
+        for (int z = 0; z < size.z; z++) {
+            unsigned int tileState = source.get(x, y, z);
+            if (tileState == 0) continue;
+
+            const glm::ivec3 p(x, y, z);
+            for (const FaceDirection &dir : faceDirections) {
+                glm::ivec3 n = p;
+                n[dir.axis] += dir.sign;
+                if (source.isEmpty(n.x, n.y, n.z)) {
+                    addQuad(out, dir, p[dir.axis], p[dir.uAxis], p[dir.vAxis], 1, 1, palette, tileState, offset);
+                }
+            }
+        }
+    }
+}
+
+
+// One quad for every exposed voxel face.
+template <class Source>
+void generateNaive(const Source &source, const Palette &palette, glm::vec3 offset, MeshBuffer &out)
+{
+    for (int x = 0; x < source.size().x; x++) {
+        generateNaiveLayer(source, x, palette, offset, out);
+    }
+}
+
+
+// Exposed faces of a single slice perpendicular to dir.axis, stored as palette index per (u, v).
+// Returns whether the slice has any exposed face.
+template <class Source>
+bool sliceFaceMask(const Source &source, const FaceDirection &dir, int slice, std::vector<unsigned int> &mask)
+{
+    const glm::ivec3 size = source.size();
+    const int sizeU = size[dir.uAxis];
+    const int sizeV = size[dir.vAxis];
+    mask.assign(sizeU * sizeV, 0);
+    bool hasFaces = false;
+
+    glm::ivec3 p;
+    p[dir.axis] = slice;
+    for (int v = 0; v < sizeV; v++) {
+        p[dir.vAxis] = v;
+        for (int u = 0; u < sizeU; u++) {
+            p[dir.uAxis] = u;
+            unsigned int tileState = source.get(p.x, p.y, p.z);
+            if (tileState == 0) continue;
+            glm::ivec3 n = p;
+            n[dir.axis] += dir.sign;
+            if (source.isEmpty(n.x, n.y, n.z)) {
+                mask[u + v * sizeU] = tileState;
+                hasFaces = true;
+            }
+        }
+    }
+    return hasFaces;
+}
+
+
+// Same as above, using the occupancy bits.
+template <class Source>
+bool sliceFaceMask(const Source &source, const OccupancyMask &occupancy, const FaceDirection &dir, int slice,
+    std::vector<unsigned int> &mask)
+{
+    const glm::ivec3 size = source.size();
+    const int sizeU = size[dir.uAxis];
+    const int sizeV = size[dir.vAxis];
+    const int direction = &dir - faceDirections;
+    mask.assign(sizeU * sizeV, 0);
+
+    // Slices along x and y cover whole columns, slices along z a single bit of every column.
+    int xBegin = dir.axis == 0 ? slice : 0, xEnd = dir.axis == 0 ? slice + 1 : size.x;
+    int yBegin = dir.axis == 1 ? slice : 0, yEnd = dir.axis == 1 ? slice + 1 : size.y;
+    int wBegin = dir.axis == 2 ? slice >> 6 : 0;
+    int wEnd = dir.axis == 2 ? wBegin + 1 : occupancy.wordsPerColumn();
+    uint64_t sliceBits = dir.axis == 2 ? (uint64_t)1 << (slice & 63) : ~(uint64_t)0;
+    bool hasFaces = false;
+
+    for (int x = xBegin; x < xEnd; x++) {
+        for (int y = yBegin; y < yEnd; y++) {
+            for (int w = wBegin; w < wEnd; w++) {
+                uint64_t faces = occupancy.visibleFaces(x, y, w, direction) & sliceBits;
+                hasFaces = hasFaces || faces != 0;
+                while (faces != 0) {
+                    int bit = __builtin_ctzll(faces);
+                    faces &= faces - 1;
+                    const glm::ivec3 p(x, y, 64 * w + bit);
+                    mask[p[dir.uAxis] + p[dir.vAxis] * sizeU] = source.get(p.x, p.y, p.z);
+                }
+            }
+        }
+    }
+    return hasFaces;
+}
+
+
+// Covers the mask row by row with maximal rectangles of equal palette index. Clears the mask.
+void greedyMergeMask(std::vector<unsigned int> &mask, int sizeU, int sizeV, const FaceDirection &dir, int slice,
+    const Palette &palette, glm::vec3 offset, MeshBuffer &out);
+
+
+// For every face direction and every slice along its axis, exposed faces are merged into
+// maximal rectangles of equal palette index.
+template <class Source>
+void generateGreedy(const Source &source, const Palette &palette, glm::vec3 offset, MeshBuffer &out,
+    const OccupancyMask *occupancy = nullptr)
+{
+    const glm::ivec3 size = source.size();
+    std::vector<unsigned int> mask;
+    for (const FaceDirection &dir : faceDirections) {
+        for (int slice = 0; slice < size[dir.axis]; slice++) {
+            bool hasFaces = occupancy != nullptr
+                ? sliceFaceMask(source, *occupancy, dir, slice, mask)
+                : sliceFaceMask(source, dir, slice, mask);
+            if (hasFaces) {
+                greedyMergeMask(mask, size[dir.uAxis], size[dir.vAxis], dir, slice, palette, offset, out);
+            }
+        }
+    }
+}
+
+
+template <class Source>
+void generate(const Source &source, MeshingMode mode, const Palette &palette, glm::vec3 offset, MeshBuffer &out,
+    const OccupancyMask *occupancy = nullptr)
+{
+    switch (mode) {
+        case MeshingMode::GREEDY:
+            generateGreedy(source, palette, offset, out, occupancy);
+            break;
+        case MeshingMode::NAIVE:
+        default:
+            if (occupancy != nullptr) {
+                for (int x = 0; x < source.size().x; x++) {
+                    generateNaiveLayer(source, *occupancy, x, palette, offset, out);
+                }
+            } else {
+                generateNaive(source, palette, offset, out);
+            }
+            break;
+    }
+}
+
+
+// Meshes are composed of independent segments: one per x layer for NAIVE meshing and one per face
+// direction and slice for GREEDY meshing. Concatenating all segments in order gives the same mesh
+// as generate(). A voxel edit only changes the segments returned by segmentsAround().
+int segmentCount(glm::ivec3 size, MeshingMode mode);
+
+// Face direction and slice of a GREEDY segment.
+void greedySegment(glm::ivec3 size, int segment, int &direction, int &slice);
+
+// Sorted segments which may change if voxels in the box [lo, hi] are edited.
+std::vector<int> segmentsAround(glm::ivec3 size, MeshingMode mode, glm::ivec3 lo, glm::ivec3 hi);
+
+
+// Appends a single segment to out.
+template <class Source>
+void generateSegment(const Source &source, MeshingMode mode, int segment, const Palette &palette, glm::vec3 offset,
+    MeshBuffer &out, const OccupancyMask *occupancy = nullptr)
+{
+    if (mode == MeshingMode::GREEDY) {
+        const glm::ivec3 size = source.size();
+        int direction, slice;
+        greedySegment(size, segment, direction, slice);
+        const FaceDirection &dir = faceDirections[direction];
+        std::vector<unsigned int> mask;
+        bool hasFaces = occupancy != nullptr
+            ? sliceFaceMask(source, *occupancy, dir, slice, mask)
+            : sliceFaceMask(source, dir, slice, mask);
+        if (hasFaces) {
+            greedyMergeMask(mask, size[dir.uAxis], size[dir.vAxis], dir, slice, palette, offset, out);
+        }
+    } else if (occupancy != nullptr) {
+        generateNaiveLayer(source, *occupancy, segment, palette, offset, out);
+    } else {
+        generateNaiveLayer(source, segment, palette, offset, out);
+    }
+}
+
+
+// Generates segments [first, last) on the shared thread pool, one buffer per segment.
+// Concatenating the buffers gives the same bytes as generating the segments one after another.
+template <class Source>
+std::vector<MeshBuffer> generateSegmentsParallel(const Source &source, MeshingMode mode, int first, int last,
+    const Palette &palette, glm::vec3 offset, bool packed, const OccupancyMask *occupancy = nullptr)
+{
+    std::vector<MeshBuffer> segments(std::max(last - first, 0));
+    ThreadPool::shared().parallelFor(segments.size(), [&](int i) {
+        segments[i].packed = packed;
+        generateSegment(source, mode, first + i, palette, offset, segments[i], occupancy);
+    });
+    return segments;
+}
+
+
+// Appends the segments to out in order, offsetting their indices.
+void concatenate(const std::vector<MeshBuffer> &segments, MeshBuffer &out);
+
+
+} // namespace VoxelMesher
+
+#endif // VOXELMESHER_H
@@ -0,0 +1,229 @@
+#include "worldstreamer.h"
+
+#include <glm/common.hpp> // glm::floor
+#include <glm/geometric.hpp> // glm::distance, glm::dot, glm::normalize
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+
+WorldStreamer::WorldStreamer(ChunkedTileMap3d &map, ChunkSource source) :
+        map(map),
+        source(source),
+        priorityLimit(std::numeric_limits<float>::infinity())
+{
+}
+
+
+glm::vec3 WorldStreamer::chunkCenter(glm::ivec3 key) const {
+    return (glm::vec3(key) + 0.5f) * (float)ChunkedTileMap3d::CHUNK_SIZE;
+}
+
+
+float WorldStreamer::priority(glm::ivec3 key, glm::vec3 position, glm::vec3 viewDirection) const {
+    // Distance, doubled for chunks behind the viewer.
+    const glm::vec3 offset = chunkCenter(key) - position;
+    const float distance = glm::length(offset);
+    if (distance < ChunkedTileMap3d::CHUNK_SIZE) {
+        return distance;
+    }
+    return distance * (1.5f - 0.5f * glm::dot(offset / distance, viewDirection));
+}
+
+
+void WorldStreamer::update(glm::vec3 position, glm::vec3 viewDirection) {
+    frame++;
+    if (glm::length(viewDirection) > 0.0f) {
+        viewDirection = glm::normalize(viewDirection);
+    }
+    receiveChunks();
+    evictChunks(position, viewDirection);
+    requestChunks(position, viewDirection);
+    meshChunks(position, viewDirection);
+}
+
+
+void WorldStreamer::receiveChunks() {
+    for (auto& it : slots) {
+        Slot &slot = it.second;
+        if (slot.loaded || slot.cells.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            continue;
+        }
+        map.insertChunk(it.first, slot.cells.get());
+        slot.loaded = true;
+        slot.memoryUsage = map.chunkMemoryUsage(it.first);
+        memoryUsage += slot.memoryUsage;
+        loads++;
+    }
+}
+
+
+void WorldStreamer::requestChunks(glm::vec3 position, glm::vec3 viewDirection) {
+    std::vector<std::pair<float, glm::ivec3>> candidates;
+    int pending = 0;
+    const glm::ivec3 center = ChunkedTileMap3d::chunkCoord(glm::ivec3(glm::floor(position)));
+    const int range = (int)std::ceil(loadRadius / ChunkedTileMap3d::CHUNK_SIZE);
+    for (int x = center.x - range; x <= center.x + range; x++) {
+        for (int y = center.y - range; y <= center.y + range; y++) {
+            for (int z = center.z - range; z <= center.z + range; z++) {
+                const glm::ivec3 key(x, y, z);
+                if (glm::distance(chunkCenter(key), position) > loadRadius) continue;
+                auto it = slots.find(key);
+                if (it != slots.end()) {
+                    it->second.lastUse = frame;
+                    pending += !it->second.loaded;
+                    continue;
+                }
+                const float p = priority(key, position, viewDirection);
+                if (p < priorityLimit) {
+                    candidates.emplace_back(p, key);
+                }
+            }
+        }
+    }
+
+    if (memoryUsage >= memoryBudget) {
+        return;
+    }
+    const size_t count = std::min(candidates.size(), (size_t)std::max(0, maxPendingChunks - pending));
+    std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(),
+        [](const std::pair<float, glm::ivec3> &a, const std::pair<float, glm::ivec3> &b) {
+            return a.first < b.first;
+        });
+    for (size_t i = 0; i < count; i++) {
+        const glm::ivec3 key = candidates[i].second;
+        ChunkSource produce = source;
+        Slot &slot = slots[key];
+        slot.lastUse = frame;
+        slot.cells = ThreadPool::shared().submit([produce, key]() { return produce(key); });
+    }
+}
+
+
+bool WorldStreamer::waitsForNeighbours(glm::ivec3 key, glm::vec3 position, glm::vec3 viewDirection) const {
+    for (int a = 0; a < 3; a++) {
+        for (int d = -1; d <= 1; d += 2) {
+            glm::ivec3 neighbour = key;
+            neighbour[a] += d;
+            auto it = slots.find(neighbour);
+            if (it != slots.end()) {
+                if (!it->second.loaded) return true;
+                continue;
+            }
+            if (glm::distance(chunkCenter(neighbour), position) <= loadRadius
+                && priority(neighbour, position, viewDirection) < priorityLimit) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+
+void WorldStreamer::meshChunks(glm::vec3 position, glm::vec3 viewDirection) {
+    std::vector<std::pair<float, glm::ivec3>> outdated;
+    for (auto& it : slots) {
+        if (it.second.loaded && map.isMeshOutdated(it.first) && !waitsForNeighbours(it.first, position, viewDirection)) {
+            outdated.emplace_back(priority(it.first, position, viewDirection), it.first);
+        }
+    }
+    const size_t count = std::min(outdated.size(), (size_t)std::max(0, maxMeshesPerUpdate));
+    std::partial_sort(outdated.begin(), outdated.begin() + count, outdated.end(),
+        [](const std::pair<float, glm::ivec3> &a, const std::pair<float, glm::ivec3> &b) {
+            return a.first < b.first;
+        });
+
+    std::vector<glm::ivec3> keys;
+    for (size_t i = 0; i < count; i++) {
+        keys.push_back(outdated[i].second);
+    }
+    map.updateMeshes(keys);
+    for (glm::ivec3 key : keys) {
+        Slot &slot = slots[key];
+        memoryUsage -= slot.memoryUsage;
+        slot.memoryUsage = map.chunkMemoryUsage(key);
+        memoryUsage += slot.memoryUsage;
+    }
+}
+
+
+void WorldStreamer::evictChunks(glm::vec3 position, glm::vec3 viewDirection) {
+    std::vector<glm::ivec3> far;
+    for (auto& it : slots) {
+        if (glm::distance(chunkCenter(it.first), position) > unloadRadius) {
+            far.push_back(it.first);
+        }
+    }
+    for (glm::ivec3 key : far) {
+        evict(key);
+    }
+
+    if (memoryUsage <= memoryBudget) {
+        // Room again once out of range chunks were dropped.
+        if (!far.empty()) {
+            priorityLimit = std::numeric_limits<float>::infinity();
+        }
+        return;
+    }
+
+    // Least recently used first, then the least important ones.
+    std::vector<std::pair<glm::ivec3, Slot*>> loaded;
+    for (auto& it : slots) {
+        if (it.second.loaded) {
+            loaded.emplace_back(it.first, &it.second);
+        }
+    }
+    std::vector<float> priorities(loaded.size());
+    std::vector<int> order(loaded.size());
+    for (size_t i = 0; i < loaded.size(); i++) {
+        priorities[i] = priority(loaded[i].first, position, viewDirection);
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+        if (loaded[a].second->lastUse != loaded[b].second->lastUse) {
+            return loaded[a].second->lastUse < loaded[b].second->lastUse;
+        }
+        return priorities[a] > priorities[b];
+    });
+    for (int i : order) {
+        if (memoryUsage <= memoryBudget) break;
+        if (loaded[i].second->lastUse == frame - 1) {
+            // In range, loading it again would only evict another one.
+            priorityLimit = std::min(priorityLimit, priorities[i]);
+        }
+        evict(loaded[i].first);
+    }
+}
+
+
+void WorldStreamer::evict(glm::ivec3 key) {
+    auto it = slots.find(key);
+    if (it == slots.end()) {
+        return;
+    }
+    if (it->second.loaded) {
+        map.removeChunk(key);
+        memoryUsage -= it->second.memoryUsage;
+        evictions++;
+    }
+    // A chunk still being produced is dropped once its job finishes.
+    slots.erase(it);
+}
+
+
+WorldStreamer::Stats WorldStreamer::getStats() const {
+    Stats stats;
+    for (auto& it : slots) {
+        if (it.second.loaded) {
+            stats.loadedChunks++;
+        } else {
+            stats.pendingChunks++;
+        }
+    }
+    stats.memoryUsage = memoryUsage;
+    stats.loads = loads;
+    stats.evictions = evictions;
+    return stats;
+}
@@ -0,0 +1,85 @@
+#ifndef WORLDSTREAMER_H
+#define WORLDSTREAMER_H
+
+#include <glm/vec3.hpp> // glm::vec3, glm::ivec3
+
+#include <stdint.h>
+#include <functional>
+#include <future>
+#include <unordered_map>
+#include <vector>
+
+#include "chunkedtilemap3d.h"
+
+
+// Keeps the chunks of a ChunkedTileMap3d around a point loaded. Chunks within loadRadius are produced
+// by a chunk source on the thread pool, meshed and uploaded, nearest and most central to the view
+// first. Chunks beyond unloadRadius are evicted with their cells and meshes, and so are the least
+// recently used ones while the chunks take more than memoryBudget bytes. The work per update is
+// limited, so a fast moving camera does not cause long frames.
+// Positions are in voxel coordinates of the map. Evicted chunks are produced again by the source when
+// they come back into range, edits made to them in the meantime are lost.
+class WorldStreamer {
+    public:
+        // Cells of the chunk at key, CHUNK_SIZE^3 of them in ChunkedTileMap3d::localIndex order. Runs on
+        // the thread pool, possibly for several chunks at once.
+        typedef std::function<CellStorage(glm::ivec3 key)> ChunkSource;
+
+        float loadRadius = 256.0f;
+        float unloadRadius = 320.0f;
+        // Cells and meshes (on CPU and GPU) of the streamed chunks.
+        size_t memoryBudget = (size_t)512 << 20;
+        // Chunks produced at once and meshed per update.
+        int maxPendingChunks = 16;
+        int maxMeshesPerUpdate = 8;
+
+        struct Stats {
+            int loadedChunks = 0, pendingChunks = 0;
+            size_t memoryUsage = 0;
+            // Since the streamer was created.
+            size_t loads = 0, evictions = 0;
+        };
+
+        // Chunks still being produced when the streamer is destroyed are finished and dropped.
+        WorldStreamer(ChunkedTileMap3d &map, ChunkSource source);
+
+        WorldStreamer(const WorldStreamer &other) = delete;
+        WorldStreamer& operator=(const WorldStreamer &other) = delete;
+
+        // Call once per frame on the GL thread.
+        void update(glm::vec3 position, glm::vec3 viewDirection);
+
+        Stats getStats() const;
+
+    private:
+        struct Slot {
+            bool loaded = false;
+            std::future<CellStorage> cells;
+            uint64_t lastUse = 0;
+            // Of the chunk as last inserted and meshed.
+            size_t memoryUsage = 0;
+        };
+
+        ChunkedTileMap3d &map;
+        ChunkSource source;
+        std::unordered_map<glm::ivec3, Slot, ChunkKeyHash> slots;
+        uint64_t frame = 0;
+        size_t memoryUsage = 0;
+        size_t loads = 0, evictions = 0;
+        // Chunks further away than this are not loaded, lowered when the budget forces evictions of
+        // chunks in range and raised again once there is room.
+        float priorityLimit;
+
+        glm::vec3 chunkCenter(glm::ivec3 key) const;
+        float priority(glm::ivec3 key, glm::vec3 position, glm::vec3 viewDirection) const;
+        void receiveChunks();
+        void requestChunks(glm::vec3 position, glm::vec3 viewDirection);
+        void meshChunks(glm::vec3 position, glm::vec3 viewDirection);
+        void evictChunks(glm::vec3 position, glm::vec3 viewDirection);
+        void evict(glm::ivec3 key);
+        // Whether the mesh would change again once more neighbours are loaded.
+        bool waitsForNeighbours(glm::ivec3 key, glm::vec3 position, glm::vec3 viewDirection) const;
+};
+
+
+#endif // WORLDSTREAMER_H